@@ -0,0 +1,96 @@
+#include "common/common.h"
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+// Compares angle() against angle_batch() on random, mostly straight corners
+// like they appear in a relaxed ruffle.
+int inner_main(int argc, char *argv[]) {
+	int n = argc > 1 ? std::stoi(argv[1]) : 1 << 20;
+	n -= n % angle_batch_size;
+	int repetitions = 20;
+
+	vector<Vector6> corners(n);
+	for (auto &corner : corners) {
+		corner << 0., 0., 1., 0., 2., 0.;
+		corner += 0.1 * VectorX::Random(6);
+	}
+
+	using clock = std::chrono::steady_clock;
+	auto corners_per_second = [&](clock::time_point start) {
+		real seconds = std::chrono::duration<real>(clock::now() - start).count();
+		return n * repetitions / seconds;
+	};
+
+	// scalar
+	real checksum_scalar = 0.;
+	Vector6 grad;
+	auto start = clock::now();
+	for (int r = 0; r < repetitions; r++) {
+		for (int i = 0; i < n; i++) {
+			checksum_scalar += angle(corners[i], &grad);
+			checksum_scalar += grad.sum();
+		}
+	}
+	real scalar_rate = corners_per_second(start);
+
+	// batched, including the gather into structure-of-arrays layout
+	real checksum_batch = 0.;
+	real max_error = 0.;
+	array<AngleBatch, 6> x, grad_batch;
+	start = clock::now();
+	for (int r = 0; r < repetitions; r++) {
+		for (int i = 0; i < n; i += angle_batch_size) {
+			for (int lane = 0; lane < angle_batch_size; lane++) {
+				for (int k = 0; k < 6; k++) {
+					x[k](lane) = corners[i+lane](k);
+				}
+			}
+			AngleBatch theta = angle_batch(x, &grad_batch);
+			checksum_batch += theta.sum();
+			for (int k = 0; k < 6; k++) {
+				checksum_batch += grad_batch[k].sum();
+			}
+		}
+	}
+	real batch_rate = corners_per_second(start);
+
+	for (int i = 0; i < n; i += angle_batch_size) {
+		for (int lane = 0; lane < angle_batch_size; lane++) {
+			for (int k = 0; k < 6; k++) {
+				x[k](lane) = corners[i+lane](k);
+			}
+		}
+		AngleBatch theta = angle_batch(x, &grad_batch);
+		for (int lane = 0; lane < angle_batch_size; lane++) {
+			max_error = max(max_error, std::abs(theta(lane) - angle(corners[i+lane], &grad)));
+			for (int k = 0; k < 6; k++) {
+				max_error = max(max_error, std::abs(grad_batch[k](lane) - grad(k)));
+			}
+		}
+	}
+
+	cout << "corners: " << n << ", batch size: " << angle_batch_size << endl;
+	cout << "scalar:  " << scalar_rate << " corners/s" << endl;
+	cout << "batched: " << batch_rate << " corners/s (" << batch_rate / scalar_rate << "x)" << endl;
+	cout << "max difference: " << max_error << endl;
+	cout << "checksums: " << checksum_scalar << " " << checksum_batch << endl;
+
+	return 0;
+}
+
+}
@@ -0,0 +1,67 @@
+#include "ruffle/ruffle.h"
+#include "simulation/lbfgs.h"
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+// Clones a ruffle whose sections were subdivided a few times, like the
+// particles of a ParticleSwarm or an undo step, and checks that the clone
+// has the same energy.
+int inner_main(int argc, char *argv[]) {
+	int steps = argc > 1 ? std::stoi(argv[1]) : 10;
+	int subdivisions = argc > 2 ? std::stoi(argv[2]) : 3;
+	int repetitions = 200;
+
+	Ruffle ruffle = Ruffle::create_ruffle_stack(steps, 3., 5.28, 0.5);
+	for (int i = 0; i < subdivisions; i++) {
+		for (auto it = ruffle.sections.begin(); it != ruffle.sections.end(); ++it) {
+			if (it->mesh_segments.size() >= 2) {
+				it = ruffle.subdivide(it);
+			}
+		}
+	}
+	ruffle.update_simulation_mesh();
+	ruffle.simulator.reset(new simulation::LBFGS(ruffle.simulation_mesh));
+	ruffle.simulation_mesh.generate_air_mesh();
+
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	size_t checksum = 0;
+	for (int r = 0; r < repetitions; r++) {
+		Ruffle copy = ruffle.clone();
+		checksum += copy.simulation_mesh.segments.size();
+	}
+	real seconds = std::chrono::duration<real>(clock::now() - start).count();
+
+	Ruffle copy = ruffle.clone();
+	copy.verify();
+	VectorX grad = VectorX::Zero(ruffle.simulation_mesh.dof());
+	real energy = ruffle.simulation_mesh.energy(ruffle.simulation_mesh.x, &grad);
+	real copy_energy = copy.simulation_mesh.energy(copy.simulation_mesh.x, &grad);
+
+	cout << "sections: " << ruffle.sections.size()
+	     << ", connection points: " << ruffle.connection_points.size()
+	     << ", vertices: " << ruffle.simulation_mesh.vertices.size()
+	     << ", segments: " << ruffle.simulation_mesh.segments.size() << endl;
+	cout << "clone: " << 1e6 * seconds / repetitions << " us" << endl;
+	cout << "energy difference: " << std::abs(energy - copy_energy) << endl;
+	cout << "checksum: " << checksum << endl;
+
+	return 0;
+}
+
+}
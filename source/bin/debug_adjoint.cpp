@@ -0,0 +1,73 @@
+#include "ruffle/ruffle.h"
+#include "simulation/newton.h"
+#include "optimization/adjoint.h"
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+// Optimizes the section lengths of a ruffle stack with Adjoint::optimize for
+// an ellipse a bit narrower and taller than its solved shape, and compares
+// the target energy before and after.
+int inner_main(int argc, char *argv[]) {
+	int steps = argc > 1 ? std::stoi(argv[1]) : 2;
+	int max_iterations = argc > 2 ? std::stoi(argv[2]) : 50;
+
+	Ruffle ruffle = Ruffle::create_ruffle_stack(steps, 3., 5.28, 0.5);
+	ruffle.update_simulation_mesh();
+	// the adjoint gradient assumes an equilibrium
+	auto newton = std::make_unique<simulation::Newton>(ruffle.simulation_mesh);
+	newton->epsilon = 1e-13;
+	ruffle.simulator = std::move(newton);
+	ruffle.solve_settings.max_steps = 3000;
+	ruffle.physics_solve();
+
+	const VectorX &x = ruffle.simulation_mesh.x;
+	Eigen::Map<const Matrix<real, 2, -1>> pos(x.data(), 2, x.size()/2);
+	Vector2 lo = pos.rowwise().minCoeff();
+	Vector2 hi = pos.rowwise().maxCoeff();
+	Vector2 center = 0.5 * (lo + hi);
+	Vector2 radius = 0.5 * (hi - lo).cwiseProduct(Vector2(0.9, 1.1));
+	// a cut line in the xy plane, like ModelPart gets from the model
+	const int n = 64;
+	Eigen::MatrixXd ellipse(n, 3);
+	for (int i = 0; i < n; i++) {
+		real angle = 2*M_PI*i/n;
+		ellipse.row(i) << center(0) + radius(0)*cos(angle), center(1) + radius(1)*sin(angle), 0.;
+	}
+	optimization::TargetShape target(ellipse, Vector3::Zero(), Vector3::UnitX(), Vector3::UnitY());
+
+	optimization::Adjoint adjoint(target);
+	adjoint.param.max_iterations = max_iterations;
+	real before = adjoint.target.energy(ruffle);
+
+	auto start = std::chrono::steady_clock::now();
+	int improvements = adjoint.optimize(ruffle);
+	real seconds = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count();
+
+	real after = adjoint.target.energy(ruffle);
+	cout << "target energy " << before << " -> " << after
+	     << " after " << improvements << " improvements, "
+	     << adjoint.forward_solves << " forward solves, " << seconds << " s" << endl;
+	cout << "lengths";
+	for (auto &section : ruffle.sections) {
+		cout << " " << section.length;
+	}
+	cout << endl;
+	return 0;
+}
+
+}
@@ -0,0 +1,85 @@
+#include "ruffle/ruffle.h"
+#include "simulation/lbfgs.h"
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+// worst quality of the air mesh triangles, like AirMesh::relax rates them
+static real worst_quality(const simulation::AirMesh &air_mesh, const VectorX &x) {
+	auto position = [&](int i) -> Vector2 {
+		if (const Vector2 *fixed = std::get_if<Vector2>(&air_mesh.vertices[i])) {
+			return *fixed;
+		}
+		return x.segment<2>(2*std::get<int>(air_mesh.vertices[i]));
+	};
+	real res = infinity;
+	for (auto &f : air_mesh.faces()) {
+		Vector2 a = position(f[0]), b = position(f[1]), c = position(f[2]);
+		Vector2 ab = b-a, ac = c-a, bc = c-b;
+		real area = 0.5*(ab.x() * ac.y() - ab.y() * ac.x());
+		res = min(res, area / (ab.squaredNorm() + ac.squaredNorm() + bc.squaredNorm()));
+	}
+	return res;
+}
+
+// Solves the same ruffle twice, once relaxing the air mesh from the worklist
+// of moved vertices and once from all edges after every step, and compares
+// the relax time and the worst triangle after each solve. The lengths are
+// changed between solves, so the vertices drift a little at a time.
+int inner_main(int argc, char *argv[]) {
+	int steps = argc > 1 ? std::stoi(argv[1]) : 4;
+	int solves = argc > 2 ? std::stoi(argv[2]) : 20;
+
+	Ruffle base = Ruffle::create_ruffle_stack(steps, 3., 5.28, 0.5);
+	base.update_simulation_mesh();
+	base.simulator.reset(new simulation::LBFGS(base.simulation_mesh));
+	base.physics_solve();
+	base.simulation_mesh.generate_air_mesh();
+
+	for (bool worklist : {true, false}) {
+		Ruffle ruffle = base.clone();
+		ruffle.simulator.reset(new simulation::LBFGS(ruffle.simulation_mesh));
+		if (!worklist) {
+			ruffle.simulation_mesh.air_mesh.full_relax_interval = 1;
+		}
+
+		real worst = infinity;
+		int relax_calls = 0, relax_flips = 0;
+		real relax_time = 0.;
+		for (int i = 0; i < solves; i++) {
+			for (auto &section : ruffle.sections) {
+				section.length *= 1.002;
+			}
+			ruffle.update_simulation_mesh();
+			Ruffle::SolveReport report = ruffle.physics_solve();
+			relax_calls += report.relax_calls;
+			relax_flips += report.relax_flips;
+			relax_time += report.relax_time;
+			worst = min(worst, worst_quality(ruffle.simulation_mesh.air_mesh, ruffle.simulation_mesh.x));
+		}
+
+		cout << (worklist ? "worklist" : "all edges")
+		     << ": relax calls " << relax_calls
+		     << ", with flips " << relax_flips
+		     << ", relax time " << relax_time << " s"
+		     << ", worst quality " << worst << endl;
+	}
+
+	return 0;
+}
+
+}
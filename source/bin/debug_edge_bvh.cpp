@@ -0,0 +1,127 @@
+#include "common/edge_bvh.h"
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+using Points = EdgeBVH::Points;
+
+// signed distance over all edges, inside by the even-odd rule, written
+// independently of EdgeBVH
+static real brute_force(const Points &polygon, const Vector2 &p) {
+	real best = infinity;
+	bool inside = false;
+	int n = polygon.cols();
+	for (int i = 0, j = n-1; i < n; j = i++) {
+		Vector2 a = polygon.col(j), b = polygon.col(i);
+		Vector2 d = b - a;
+		real t = d.squaredNorm() > 0. ? std::clamp((p-a).dot(d) / d.squaredNorm(), 0., 1.) : 0.;
+		best = min(best, (a + t*d - p).squaredNorm());
+		if ((a(1) > p(1)) != (b(1) > p(1)) && p(0) < (b(0)-a(0)) * (p(1)-a(1)) / (b(1)-a(1)) + a(0)) {
+			inside = !inside;
+		}
+	}
+	return inside ? std::sqrt(best) : -std::sqrt(best);
+}
+
+struct Checks {
+	int total = 0;
+	int mismatches = 0;
+
+	void operator()(const std::string &name, const EdgeBVH &bvh, const Points &polygon, const Vector2 &p) {
+		real expected = brute_force(polygon, p);
+		// on the boundary the sign is arbitrary
+		if (std::abs(expected) < 1e-12) {
+			return;
+		}
+		total++;
+		real distance = bvh.signed_distance(p);
+		if (std::abs(distance - expected) > 1e-12) {
+			mismatches++;
+			cout << name << " at " << p.transpose() << ": " << distance << " instead of " << expected << endl;
+		}
+	}
+};
+
+// Compares EdgeBVH::signed_distance with a brute force loop over all edges on
+// wiggly star shaped polygons of 3 to 5000 points in both orientations and on
+// a comb with duplicate and collinear points, and times both.
+int inner_main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+	Checks check;
+
+	std::mt19937_64 rng(3);
+	std::uniform_real_distribution<real> uniform(0., 1.);
+	for (int n : {3, 5, 17, 64, 200, 1000, 5000}) {
+		Points polygon(2, n);
+		for (int i = 0; i < n; i++) {
+			real angle = 2*M_PI*i/n;
+			real radius = 1. + 0.4*sin(7*angle) + 0.2*uniform(rng);
+			polygon.col(i) << radius*cos(angle), radius*sin(angle);
+		}
+		Points queries(2, 20000);
+		for (int k = 0; k < queries.cols(); k++) {
+			queries.col(k) << 3.*uniform(rng) - 1.5, 3.*uniform(rng) - 1.5;
+		}
+		std::string name = "star of " + std::to_string(n);
+
+		EdgeBVH bvh(polygon);
+		for (int k = 0; k < queries.cols(); k++) {
+			check(name, bvh, polygon, queries.col(k));
+		}
+		Points reversed = polygon.rowwise().reverse();
+		EdgeBVH bvh_reversed(reversed);
+		for (int k = 0; k < 2000; k++) {
+			check(name + " reversed", bvh_reversed, reversed, queries.col(k));
+		}
+
+		real sum = 0.;
+		auto start = std::chrono::steady_clock::now();
+		for (int k = 0; k < queries.cols(); k++) {
+			sum += bvh.signed_distance(queries.col(k));
+		}
+		real fast = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count() / queries.cols();
+		int m = std::min<int>(queries.cols(), 2000000 / n);
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < m; k++) {
+			sum += brute_force(polygon, queries.col(k));
+		}
+		real slow = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count() / m;
+		cout << name << ": " << 1e6*fast << " us per query, brute force "
+		     << 1e6*slow << " us (" << sum << ")" << endl;
+	}
+
+	vector<real> comb = {0,0, 1,0, 1,0, 2,0, 6,0, 6,3, 5,3, 5,1, 4,1, 4,3, 3,3, 3,1, 2,1, 2,3, 2,3, 0,3, 0,2, 0,1};
+	Points polygon(2, comb.size()/2);
+	for (size_t i = 0; i < comb.size()/2; i++) {
+		polygon.col(i) << comb[2*i], comb[2*i+1];
+	}
+	for (bool reverse : {false, true}) {
+		Points points = reverse ? Points(polygon.rowwise().reverse()) : polygon;
+		EdgeBVH bvh(points);
+		for (real x = -1.; x <= 7.; x += 0.125) {
+			for (real y = -1.; y <= 4.; y += 0.125) {
+				check(reverse ? "comb reversed" : "comb", bvh, points, Vector2(x, y));
+			}
+		}
+	}
+
+	cout << check.total << " queries, " << check.mismatches << " mismatches" << endl;
+	return check.mismatches > 0;
+}
+
+}
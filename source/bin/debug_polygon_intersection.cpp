@@ -0,0 +1,232 @@
+#include "ruffle/ruffle.h"
+#include "simulation/newton.h"
+#include "common/polygon_intersection.h"
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point_xy.hpp>
+#include <boost/geometry/geometries/polygon.hpp>
+#include <boost/multiprecision/cpp_bin_float.hpp>
+
+#include <chrono>
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+namespace bg = boost::geometry;
+using Points = PolygonIntersection::Points;
+
+// 50 decimal digits, enough to make the reference exact for these inputs
+using ExactReal = boost::multiprecision::cpp_bin_float_50;
+using ExactPolygon = bg::model::polygon<bg::model::d2::point_xy<ExactReal>>;
+using DoublePolygon = bg::model::polygon<bg::model::d2::point_xy<double>>;
+
+template<typename BgPolygon>
+static BgPolygon to_boost(const Points &points) {
+	BgPolygon res;
+	for (int i = 0; i < points.cols(); i++) {
+		bg::append(res.outer(), typename bg::point_type<BgPolygon>::type(points(0,i), points(1,i)));
+	}
+	bg::correct(res);
+	return res;
+}
+
+static real reference_area(const Points &a, const Points &b) {
+	vector<ExactPolygon> intersection;
+	bg::intersection(to_boost<ExactPolygon>(a), to_boost<ExactPolygon>(b), intersection);
+	ExactReal res = 0;
+	for (auto &polygon : intersection) {
+		res += bg::area(polygon);
+	}
+	return real(res);
+}
+
+static Points polygon(std::initializer_list<real> coordinates) {
+	vector<real> c(coordinates);
+	Points res(2, c.size()/2);
+	for (size_t i = 0; i < c.size()/2; i++) {
+		res.col(i) << c[2*i], c[2*i+1];
+	}
+	return res;
+}
+
+static Points ellipse(int n, Vector2 center, Vector2 radius) {
+	Points res(2, n);
+	for (int i = 0; i < n; i++) {
+		real angle = 2*M_PI*i/n;
+		res.col(i) = center + radius.cwiseProduct(Vector2(cos(angle), sin(angle)));
+	}
+	return res;
+}
+
+// outline of a ruffle in the order TargetShape::energy uses
+static Points outline(Ruffle &ruffle) {
+	vector<Vector2> points;
+	for (auto &outline_section : ruffle.outline_sections) {
+		auto &segments = outline_section.section->mesh_segments;
+		if (outline_section.reversed) {
+			for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+				points.push_back(ruffle.simulation_mesh.get_vertex_position(*(*it)->end));
+			}
+		} else {
+			for (auto it = segments.begin(); it != segments.end(); ++it) {
+				points.push_back(ruffle.simulation_mesh.get_vertex_position(*(*it)->start));
+			}
+		}
+	}
+	Points res(2, points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		res.col(i) = points[i];
+	}
+	return res;
+}
+
+struct Checks {
+	int total = 0;
+	int failures = 0;
+	int fallbacks = 0; // left to CGAL by TargetShape::energy
+	real worst = 0.; // error relative to the area of the fixed polygon
+
+	// expected < 0 for the Boost reference
+	void operator()(const std::string &name, const Points &fixed, const Points &other, real expected = -1.) {
+		PolygonIntersection intersection(fixed);
+		std::optional<real> area = intersection.intersection_area(other);
+		real reference = expected >= 0. ? expected : reference_area(fixed, other);
+		total++;
+		if (!area) {
+			fallbacks++;
+			cout << name << ": fallback, reference " << reference << endl;
+			return;
+		}
+		real error = std::abs(*area - reference) / max(1e-12, std::abs(intersection.area()));
+		worst = max(worst, error);
+		if (error > 1e-9) {
+			failures++;
+			cout << name << ": " << *area << " instead of " << reference << endl;
+		}
+	}
+};
+
+// Compares PolygonIntersection::intersection_area with Boost.Geometry in 50
+// digit arithmetic on degenerate configurations, integer grids full of shared
+// vertices and collinear edges, and outlines of solved ruffle stacks, then
+// times both on the largest outline.
+int inner_main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+	Checks check;
+
+	Points square = polygon({0,0, 2,0, 2,2, 0,2});
+	check("same", square, square, 4.);
+	check("reversed", square, polygon({0,0, 0,2, 2,2, 2,0}), 4.);
+	check("shared edge", square, polygon({-1,0, 1,0, 1,1, -1,1}), 1.);
+	check("shared edge reversed", square, polygon({-1,0, -1,1, 1,1, 1,0}), 1.);
+	check("touching edge outside", square, polygon({-1,-1, 3,-1, 3,0, -1,0}), 0.);
+	check("touching vertex", square, polygon({2,2, 3,2, 3,3}), 0.);
+	check("vertex on edge", square, polygon({1,0, 1.5,1, 0.5,1}), 0.5);
+	check("T junction", square, polygon({1,1, 3,1, 3,3, 1,3}), 1.);
+	check("collinear points", square, polygon({0,0, 1,0, 2,0, 2,1, 1,1, 0,1}), 2.);
+	check("pinched", square, polygon({0.5,0.5, 1,1, 1.5,0.5, 1.5,1.5, 1,1, 0.5,1.5}), 0.5);
+	check("apart", square, polygon({5,5, 6,5, 6,6}), 0.);
+	check("contained", polygon({1,1, 1.5,1, 1.5,1.5}), square, 0.125);
+
+	std::mt19937_64 rng(1);
+	std::uniform_real_distribution<real> offset(-1., 1.);
+	for (int i = 0; i < 500; i++) {
+		Vector2 center(offset(rng), offset(rng));
+		Vector2 radius(1. + 0.5*offset(rng), 1. + 0.5*offset(rng));
+		check("ellipse " + std::to_string(i), ellipse(40, Vector2::Zero(), Vector2(1., 2.)), ellipse(7 + i%30, center, radius));
+	}
+
+	std::uniform_int_distribution<int> grid(0, 4);
+	for (int i = 0; i < 3000; i++) {
+		auto shape = [&]() {
+			if (i % 2) {
+				real x0 = grid(rng), y0 = grid(rng);
+				real x1 = x0 + 1 + grid(rng), y1 = y0 + 1 + grid(rng);
+				return polygon({x0,y0, x1,y0, x1,y1, x0,y1});
+			}
+			Points triangle(2, 3);
+			do {
+				for (int k = 0; k < 3; k++) {
+					triangle.col(k) << grid(rng), grid(rng);
+				}
+			} while (std::abs(polygon_area(triangle)) < 0.5);
+			return triangle;
+		};
+		Points a = shape();
+		check("grid " + std::to_string(i), a, shape());
+	}
+
+	vector<Points> outlines;
+	for (int steps : {2, 4, 8}) {
+		Ruffle base = Ruffle::create_ruffle_stack(steps, 3., 5.28, 0.5);
+		base.update_simulation_mesh();
+		for (int i = 0; i < 4; i++) {
+			Ruffle ruffle = base.clone();
+			VectorX factors = random_vector(ruffle.sections.size(), rng);
+			int k = 0;
+			for (auto &section : ruffle.sections) {
+				section.length *= 0.85 + 0.3*factors(k++);
+			}
+			ruffle.update_simulation_mesh();
+			ruffle.simulator.reset(new simulation::Newton(ruffle.simulation_mesh));
+			ruffle.solve_settings.max_steps = 200;
+			ruffle.physics_solve();
+			outlines.push_back(outline(ruffle));
+		}
+	}
+	for (size_t i = 0; i < outlines.size(); i++) {
+		const Points &o = outlines[i];
+		Vector2 lo = o.rowwise().minCoeff(), hi = o.rowwise().maxCoeff();
+		Vector2 center = 0.5*(lo + hi), extent = 0.5*(hi - lo);
+		std::string name = "outline " + std::to_string(i);
+		check(name + " itself", o, o, std::abs(polygon_area(o)));
+		check(name + " triangle", polygon({lo(0)+0.2*extent(0), lo(1), hi(0)-0.3*extent(0), lo(1), center(0), hi(1)+0.1}), o);
+		check(name + " ellipse", ellipse(64, center, extent), o);
+		for (size_t j = 0; j < outlines.size(); j++) {
+			check(name + " outline " + std::to_string(j), outlines[j], o);
+		}
+	}
+	cout << check.total << " checks, " << check.failures << " failures, "
+	     << check.fallbacks << " fallbacks, worst relative error " << check.worst << endl;
+
+	Points target = ellipse(64, Vector2(0., 1.5), Vector2(2.5, 1.5));
+	const Points &other = outlines.back();
+	PolygonIntersection intersection(target);
+	const int repetitions = 2000;
+	real sum = 0.;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repetitions; r++) {
+		sum += *intersection.intersection_area(other);
+	}
+	real fast = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count() / repetitions;
+
+	DoublePolygon boost_target = to_boost<DoublePolygon>(target), boost_other = to_boost<DoublePolygon>(other);
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repetitions/10; r++) {
+		vector<DoublePolygon> result;
+		bg::intersection(boost_target, boost_other, result);
+		for (auto &polygon : result) {
+			sum += bg::area(polygon);
+		}
+	}
+	real boost = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count() / (repetitions/10);
+	cout << "outline of " << other.cols() << " points: " << 1e6*fast << " us, Boost.Geometry in double "
+	     << 1e6*boost << " us (" << sum << ")" << endl;
+
+	return check.failures > 0;
+}
+
+}
@@ -0,0 +1,104 @@
+#include "ruffle/ruffle.h"
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+using simulation::SimulationMesh;
+using simulation::AirMesh;
+
+// number of constrained air mesh edges that are not simulation segments, plus
+// the number of segments that are not constrained edges. Also counts edges
+// whose two faces disagree on the flag.
+static int constraint_errors(const SimulationMesh &mesh) {
+	const AirMesh &air_mesh = mesh.air_mesh;
+	auto is_segment = [&](const AirMesh::MeshVertex &u, const AirMesh::MeshVertex &w) {
+		for (auto &seg : mesh.segments) {
+			const AirMesh::MeshVertex &s = *seg.start, &e = *seg.end;
+			if ((s == u && e == w) || (s == w && e == u)) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	int errors = 0;
+	int constrained = 0;
+	for (auto edge = air_mesh.cdt.finite_edges_begin(); edge != air_mesh.cdt.finite_edges_end(); ++edge) {
+		auto f = edge->first;
+		int i = edge->second;
+		if (f->is_constrained(i) != f->neighbor(i)->is_constrained(air_mesh.cdt.mirror_index(f, i))) {
+			errors++;
+		}
+		const AirMesh::MeshVertex &u = air_mesh.vertices[f->vertex((i+1)%3)->info()];
+		const AirMesh::MeshVertex &w = air_mesh.vertices[f->vertex((i+2)%3)->info()];
+		if (f->is_constrained(i)) {
+			constrained++;
+			errors += !is_segment(u, w);
+		} else {
+			errors += is_segment(u, w);
+		}
+	}
+	// a segment that isn't an edge at all is neither
+	return errors + std::abs((int)mesh.segments.size() - constrained);
+}
+
+// Splits every third segment of a ruffle stack a few times over with the
+// incremental air mesh, relaxes after every round and checks that exactly
+// the simulation segments are constrained edges afterwards.
+int inner_main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+
+	Ruffle ruffle = Ruffle::create_ruffle_stack(2, 3., 5.28, 0.5);
+	ruffle.update_simulation_mesh();
+	// from here on only the simulation mesh is edited, the sections don't
+	// follow the splits
+	SimulationMesh &mesh = ruffle.simulation_mesh;
+	mesh.incremental_air_mesh = true;
+	mesh.generate_air_mesh();
+
+	int failures = 0;
+	std::mt19937_64 rng(11);
+	for (int round = 0; round < 4; round++) {
+		vector<listref<SimulationMesh::Segment>> to_split;
+		int k = 0;
+		for (auto seg = mesh.segments.begin(); seg != mesh.segments.end(); ++seg, ++k) {
+			if (k % 3 == round % 3) {
+				to_split.push_back(seg);
+			}
+		}
+		for (auto &seg : to_split) {
+			mesh.split_segment(seg);
+		}
+		if (mesh.air_mesh.empty()) {
+			cout << "round " << round << ": split fell back to regenerating the air mesh" << endl;
+			failures++;
+			break;
+		}
+
+		// move the vertices a little so relax has something to flip
+		mesh.x += 1e-3 * random_vector(mesh.x.size(), rng);
+		mesh.air_mesh.relax(mesh.x);
+
+		int errors = constraint_errors(mesh);
+		cout << "round " << round << ": " << to_split.size() << " splits, "
+		     << mesh.segments.size() << " segments, " << errors << " constraint errors" << endl;
+		failures += errors > 0;
+	}
+
+	return failures > 0;
+}
+
+}
@@ -0,0 +1,79 @@
+#include "simulation/simulation_mesh.h"
+#include "common/thread_pool.h"
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+using simulation::SimulationMesh;
+
+// Evaluates the energy of a strip large enough for the chunked gradient,
+// first on its own and then where ThreadPool::parallel_for falls back to a
+// single chunk: from inside parallel_tasks, and from two threads at once.
+// All evaluations have to agree.
+int inner_main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+
+	SimulationMesh mesh = SimulationMesh::generate_horizontal_strip(1000., 0.1);
+	mesh.update_vertex_mass();
+	std::mt19937_64 rng(5);
+	mesh.x += 0.01 * random_vector(mesh.x.size(), rng);
+	const int n_items = 2*mesh.segments.size();
+	cout << "strip of " << mesh.segments.size() << " segments, about " << n_items << " items, "
+	     << ThreadPool::global().size() << " threads" << endl;
+
+	VectorX expected_grad = VectorX::Zero(mesh.dof());
+	real expected = mesh.energy(mesh.x, &expected_grad);
+
+	int failures = 0;
+	auto check = [&](const char *name, real energy, const VectorX &grad) {
+		real error = std::abs(energy - expected) / std::abs(expected);
+		real grad_error = (grad - expected_grad).norm() / expected_grad.norm();
+		if (!(error < 1e-12) || !(grad_error < 1e-12)) {
+			failures++;
+			cout << name << ": energy error " << error << ", gradient error " << grad_error << endl;
+		}
+	};
+
+	const int tasks = 4;
+	vector<real> energies(tasks);
+	vector<VectorX> grads(tasks, VectorX::Zero(mesh.dof()));
+	ThreadPool::global().parallel_tasks(tasks, [&](int task) {
+		energies[task] = mesh.energy(mesh.x, &grads[task]);
+	});
+	for (int i = 0; i < tasks; i++) {
+		check("inside parallel_tasks", energies[i], grads[i]);
+	}
+
+	for (int round = 0; round < 20; round++) {
+		vector<std::thread> threads;
+		for (int i = 0; i < 2; i++) {
+			threads.emplace_back([&, i]() {
+				energies[i] = mesh.energy(mesh.x, &grads[i]);
+			});
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		for (int i = 0; i < 2; i++) {
+			check("two threads", energies[i], grads[i]);
+		}
+	}
+
+	cout << failures << " failures" << endl;
+	return failures > 0;
+}
+
+}
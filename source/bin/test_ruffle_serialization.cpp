@@ -0,0 +1,95 @@
+#include "ruffle/ruffle.h"
+
+namespace ruffles {
+	int inner_main(int argc, char *argv[]);
+}
+int main(int argc, char *argv[]) {
+	try {
+		return ruffles::inner_main(argc, argv);
+	} catch (char const *x) {
+		std::cerr << "Error: " << std::string(x) << std::endl;
+	}
+	return 1;
+}
+
+
+namespace ruffles {
+
+using simulation::SimulationMesh;
+
+// Round trips a ruffle stack through Serialize/Deserialize, then serializes
+// broken copies of its simulation mesh, which Deserialize has to reject
+// while leaving the ruffle it is called on untouched.
+int inner_main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+
+	int failures = 0;
+	vector<char> buffer;
+	Ruffle::create_ruffle_stack(2, 3., 5.28, 0.5).Serialize(buffer);
+	Ruffle ruffle;
+	ruffle.Deserialize(buffer);
+	vector<char> again;
+	ruffle.Serialize(again);
+	if (again != buffer) {
+		cout << "round trip changed the data" << endl;
+		failures++;
+	}
+
+	auto expect_rejected = [&](const std::string &name, auto corrupt) {
+		Ruffle broken = Ruffle::create_ruffle_stack(2, 3., 5.28, 0.5);
+		corrupt(broken.simulation_mesh);
+		vector<char> data;
+		broken.Serialize(data);
+		try {
+			ruffle.Deserialize(data);
+			cout << name << ": accepted" << endl;
+			failures++;
+		} catch (const std::runtime_error &e) {
+			cout << name << ": " << e.what() << endl;
+		}
+		vector<char> unchanged;
+		ruffle.Serialize(unchanged);
+		if (unchanged != buffer) {
+			cout << name << ": changed the ruffle" << endl;
+			failures++;
+		}
+	};
+
+	expect_rejected("bend without a shared vertex", [](SimulationMesh &mesh) {
+		auto &bend = mesh.connection_bends.at(0);
+		bend[1] = bend[0]->start == mesh.segments.begin()->start ? std::prev(mesh.segments.end()) : mesh.segments.begin();
+	});
+	expect_rejected("bend of one segment", [](SimulationMesh &mesh) {
+		auto &bend = mesh.connection_bends.at(0);
+		bend[1] = bend[0];
+	});
+	expect_rejected("broken chain", [](SimulationMesh &mesh) {
+		auto seg = std::next(mesh.segments.begin(), 3);
+		std::swap(seg->start, seg->end);
+	});
+	expect_rejected("degree of freedom used twice", [](SimulationMesh &mesh) {
+		int first = -1;
+		for (auto &vertex : mesh.vertices) {
+			if (int *ix = std::get_if<int>(&vertex)) {
+				if (first < 0) {
+					first = *ix;
+				} else {
+					*ix = first;
+					break;
+				}
+			}
+		}
+	});
+	expect_rejected("unused degree of freedom", [](SimulationMesh &mesh) {
+		mesh.x.conservativeResize(mesh.x.size() + 2);
+		mesh.m.conservativeResize(mesh.m.size() + 2);
+		mesh.x.tail<2>().setZero();
+		mesh.m.tail<2>().setZero();
+	});
+
+	cout << failures << " failures" << endl;
+	return failures > 0;
+}
+
+}
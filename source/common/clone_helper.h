@@ -12,17 +12,23 @@ struct listref_hash {
 		return std::hash<T*>()(&*i);
 	}
 };
+/// Copies of a slot_list keep the slot indices of the original, so a
+/// reference into the original translates to the copy by its index()
 template<typename T>
 class Translate {
-	std::unordered_map<listref<T>,listref<T>,listref_hash<T>> table;
+	slot_list<T> *destination;
 public:
-	listref<T> operator()(listref<T> x) {
-		return table[x];
+	Translate(slot_list<T> &destination) : destination(&destination) {}
+
+	listref<T> operator()(listref<T> x) const {
+		return destination->at_index(x.index());
+	}
+	void remap(listref<T> &x) const {
+		x = (*this)(x);
 	}
-	template<class F>
-	void transform(listref<T> begin, listref<T> end, list<T> &destination, F f) {
-		for (listref<T> it = begin; it != end; ++it) {
-			table.emplace(it, destination.insert(destination.end(), f(*it)));
+	void remap(vector<listref<T>> &xs) const {
+		for (auto &x : xs) {
+			remap(x);
 		}
 	}
 };
@@ -1,6 +1,7 @@
 #include "common/common.h"
 
 #include <iostream>
+#include <atomic>
 
 
 namespace ruffles {
@@ -21,6 +22,72 @@ VectorX random_vector(int m) {
 	return VectorX::Random(m).array()*0.5+0.5;
 }
 
+VectorX random_vector(int m, std::mt19937_64 &rng) {
+	std::uniform_real_distribution<real> uniform(0., 1.);
+	VectorX res(m);
+	for (int i = 0; i < m; i++) {
+		res(i) = uniform(rng);
+	}
+	return res;
+}
+
+long next_version() {
+	static std::atomic<long> version(0);
+	return ++version;
+}
+
+
+template<typename Scalar>
+AngleBatchOf<Scalar> angle_batch(const array<AngleBatchOf<Scalar>, 6> &x, array<AngleBatchOf<Scalar>, 6> *grad) {
+	using AngleBatch = AngleBatchOf<Scalar>;
+	// same computation as angle(), see there
+	AngleBatch dx1 = x[2*1+0] - x[2*0+0];
+	AngleBatch dy1 = x[2*1+1] - x[2*0+1];
+	AngleBatch dx2 = x[2*2+0] - x[2*1+0];
+	AngleBatch dy2 = x[2*2+1] - x[2*1+1];
+	AngleBatch dx3 = x[2*2+0] - x[2*0+0];
+	AngleBatch dy3 = x[2*2+1] - x[2*0+1];
+
+	AngleBatch l1_sq = dx1*dx1 + dy1*dy1;
+	AngleBatch l2_sq = dx2*dx2 + dy2*dy2;
+	AngleBatch l3_sq = dx3*dx3 + dy3*dy3;
+
+	AngleBatch l1 = l1_sq.sqrt();
+	AngleBatch l2 = l2_sq.sqrt();
+
+	AngleBatch a = l1_sq + l2_sq - l3_sq;
+	AngleBatch b = 2*l1*l2;
+	AngleBatch c = (a/b).max(Scalar(-1)).min(Scalar(1));
+	AngleBatch theta = c.acos();
+
+	if (grad) {
+		AngleBatch s = (1-c*c).max(Scalar(0)).sqrt().max(Scalar(1e-6));
+		AngleBatch inv_b = 1/b;
+		AngleBatch a_inv_b2 = a*inv_b*inv_b;
+		AngleBatch r12 = l2/l1;
+		AngleBatch r21 = l1/l2;
+		AngleBatch inv_s = -1/s;
+
+		// derivatives of l1^2, l2^2 and l3^2 are sparse, p1, p2 and p3 are
+		// their entries for one coordinate
+		auto component = [&](const auto &p1, const auto &p2, const auto &p3) -> AngleBatch {
+			AngleBatch da = p1 + p2 - p3;
+			AngleBatch db = r21*p2 + r12*p1;
+			return inv_s * (da*inv_b - a_inv_b2*db);
+		};
+		AngleBatch zero = AngleBatch::Zero();
+		(*grad)[0] = component(-2*dx1, zero, -2*dx3);
+		(*grad)[1] = component(-2*dy1, zero, -2*dy3);
+		(*grad)[2] = component( 2*dx1, -2*dx2, zero);
+		(*grad)[3] = component( 2*dy1, -2*dy2, zero);
+		(*grad)[4] = component(zero, 2*dx2, 2*dx3);
+		(*grad)[5] = component(zero, 2*dy2, 2*dy3);
+	}
+
+	return theta;
+}
+template AngleBatchOf<float> angle_batch(const array<AngleBatchOf<float>, 6> &, array<AngleBatchOf<float>, 6> *);
+template AngleBatchOf<double> angle_batch(const array<AngleBatchOf<double>, 6> &, array<AngleBatchOf<double>, 6> *);
 
 real angle(Vector6 x, Vector6 *grad, Matrix6 *hessian) {
 	real dx1 = x(2*1+0) - x(2*0+0);
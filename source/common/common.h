@@ -2,6 +2,7 @@
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
+#include <Eigen/Eigenvalues>
 #include <vector>
 #include <utility>
 #include <string>
@@ -12,6 +13,9 @@
 #include <list>
 #include <array>
 #include <iterator>
+#include <random>
+
+#include "common/slot_list.h"
 
 #ifndef dbg
 #define dbg(x) debug_impl(#x, x)
@@ -63,7 +67,7 @@ using std::vector;
 using std::array;
 using std::list;
 template<typename T>
-using listref = typename list<T>::iterator;
+using listref = typename slot_list<T>::iterator;
 
 
 using std::tuple;
@@ -93,10 +97,28 @@ using Matrix6 = Eigen::Matrix<real, 6, 6>;
 using MatrixX = Eigen::Matrix<real, -1, -1>;
 
 VectorX random_vector(int n);
+// uniform in [0, 1) like random_vector(n), from a generator of the caller
+// instead of Eigen's global one, which is neither thread safe nor seedable
+VectorX random_vector(int n, std::mt19937_64 &rng);
+
+// unique, increasing across the whole process, for keying caches on topology
+long next_version();
 
 
 real angle(Vector6 x, Vector6 *grad = nullptr, Matrix6 *hessian = nullptr);
 
+// angle() for several corners at once, in structure-of-arrays layout:
+// x[k] holds coordinate k of the Vector6 of every corner in the batch. Fixed
+// size arrays let Eigen use the widest vector unit it is compiled for, a
+// float batch fits in half the registers of a double one.
+// Instantiated for float and double.
+constexpr int angle_batch_size = 8;
+template<typename Scalar>
+using AngleBatchOf = Eigen::Array<Scalar, angle_batch_size, 1>;
+using AngleBatch = AngleBatchOf<real>;
+template<typename Scalar>
+AngleBatchOf<Scalar> angle_batch(const array<AngleBatchOf<Scalar>, 6> &x, array<AngleBatchOf<Scalar>, 6> *grad = nullptr);
+
 // can't define in cpp file because template function
 template<typename T>
 void addHessianBlock(const T &mat, int row, int col, std::vector<Eigen::Triplet<real>> &target) {
@@ -107,6 +129,14 @@ void addHessianBlock(const T &mat, int row, int col, std::vector<Eigen::Triplet<
 	}
 }
 
+// clamp negative eigenvalues of a small symmetric block to zero
+template<int N>
+Matrix<real, N, N> project_psd(const Matrix<real, N, N> &mat) {
+	Eigen::SelfAdjointEigenSolver<Matrix<real, N, N>> eig(mat);
+	Matrix<real, N, 1> lambda = eig.eigenvalues().cwiseMax(0.);
+	return eig.eigenvectors() * lambda.asDiagonal() * eig.eigenvectors().transpose();
+}
+
 template<typename T1, typename T2>
 std::ostream &operator<<(std::ostream &os, const std::pair<T1, T2> &x) {
 	return os << "(" << x.first << "," << x.second << ")";
@@ -126,6 +156,13 @@ std::ostream &operator<<(std::ostream &os, const std::list<T> &x) {
 	return os;
 }
 template<typename T>
+std::ostream &operator<<(std::ostream &os, const slot_list<T> &x) {
+	os << "[";
+	std::copy(x.cbegin(), x.cend(), std::ostream_iterator<T>(os, ", "));
+	os << "]";
+	return os;
+}
+template<typename T>
 std::ostream &operator<<(std::ostream &os, const std::vector<T> &x) {
 	os << "[";
 	std::copy(x.cbegin(), x.cend(), std::ostream_iterator<T>(os, ", "));
@@ -135,7 +172,9 @@ std::ostream &operator<<(std::ostream &os, const std::vector<T> &x) {
 
 template<typename It>
 std::enable_if_t<std::is_same_v<It, typename std::list<typename std::iterator_traits<It>::value_type>::iterator> ||
-                 std::is_same_v<It, typename std::list<typename std::iterator_traits<It>::value_type>::const_iterator>,
+                 std::is_same_v<It, typename std::list<typename std::iterator_traits<It>::value_type>::const_iterator> ||
+                 std::is_same_v<It, typename slot_list<typename std::iterator_traits<It>::value_type>::iterator> ||
+                 std::is_same_v<It, typename slot_list<typename std::iterator_traits<It>::value_type>::const_iterator>,
 std::ostream &>
 operator<<(std::ostream &os, const It &x) {
 	return os << "&" << *x;
@@ -0,0 +1,289 @@
+#include "common/edge_bvh.h"
+
+#include "common/polygon_intersection.h"
+#include "common/geometry.h"
+
+#include <algorithm>
+
+namespace ruffles {
+
+namespace {
+
+real box_distance2(const Vector2 &p, const Vector2 &lo, const Vector2 &hi) {
+	return (lo - p).cwiseMax(p - hi).cwiseMax(0.).squaredNorm();
+}
+
+// deep enough for any tree built from up to 2^32 edges
+constexpr int max_depth = 64;
+
+}
+
+EdgeBVH::EdgeBVH(const Points &polygon) : points(polygon) {
+	int n = points.cols();
+	if (n == 0) {
+		return;
+	}
+	orientation = polygon_area(points) < 0. ? -1. : 1.;
+	order.resize(n);
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	nodes.reserve(2*n / leaf_size + 1);
+	build(0, n);
+}
+
+int EdgeBVH::build(int first, int count) {
+	int index = nodes.size();
+	nodes.emplace_back();
+	Vector2 lo = Vector2::Constant(infinity), hi = Vector2::Constant(-infinity);
+	for (int k = first; k < first+count; k++) {
+		lo = lo.cwiseMin(a(order[k])).cwiseMin(b(order[k]));
+		hi = hi.cwiseMax(a(order[k])).cwiseMax(b(order[k]));
+	}
+	nodes[index].lo = lo;
+	nodes[index].hi = hi;
+	nodes[index].first = first;
+	nodes[index].count = count;
+	if (count <= leaf_size) {
+		return index;
+	}
+
+	// median of the edge centers along the longer side
+	int axis = hi(0) - lo(0) >= hi(1) - lo(1) ? 0 : 1;
+	int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](int i, int j) {
+		return a(i)(axis) + b(i)(axis) < a(j)(axis) + b(j)(axis);
+	});
+	build(first, half);
+	int right = build(first + half, count - half);
+	nodes[index].right = right;
+	return index;
+}
+
+bool EdgeBVH::empty() const {
+	return nodes.empty();
+}
+
+Vector2 EdgeBVH::a(int edge) const {
+	return points.col(edge);
+}
+
+Vector2 EdgeBVH::b(int edge) const {
+	return points.col(edge+1 < points.cols() ? edge+1 : 0);
+}
+
+real EdgeBVH::distance(const Vector2 &p, int *edge) const {
+	real best = infinity;
+	int best_edge = -1;
+	if (empty()) {
+		return best;
+	}
+	int stack[max_depth];
+	int size = 0;
+	stack[size++] = 0;
+	while (size > 0) {
+		const Node &node = nodes[stack[--size]];
+		if (box_distance2(p, node.lo, node.hi) >= best) {
+			continue;
+		}
+		if (node.right < 0) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				real d = segment_distance2(p, a(order[k]), b(order[k]));
+				if (d < best) {
+					best = d;
+					best_edge = order[k];
+				}
+			}
+			continue;
+		}
+		// nearer child on top of the stack
+		int left = &node - nodes.data() + 1;
+		int right = node.right;
+		if (box_distance2(p, nodes[left].lo, nodes[left].hi) < box_distance2(p, nodes[right].lo, nodes[right].hi)) {
+			std::swap(left, right);
+		}
+		stack[size++] = left;
+		stack[size++] = right;
+	}
+	if (edge) {
+		*edge = best_edge;
+	}
+	return std::sqrt(best);
+}
+
+int EdgeBVH::winding(const Vector2 &p) const {
+	int res = 0;
+	if (empty()) {
+		return res;
+	}
+	// only edges crossing the ray from p to the right count
+	int stack[max_depth];
+	int size = 0;
+	stack[size++] = 0;
+	while (size > 0) {
+		const Node &node = nodes[stack[--size]];
+		if (p(1) < node.lo(1) || p(1) > node.hi(1) || p(0) > node.hi(0)) {
+			continue;
+		}
+		if (node.right < 0) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				res += winding_crossing(p, a(order[k]), b(order[k]));
+			}
+			continue;
+		}
+		stack[size++] = &node - nodes.data() + 1;
+		stack[size++] = node.right;
+	}
+	return res;
+}
+
+Vector2 EdgeBVH::normal(int edge) const {
+	Vector2 d = (b(edge) - a(edge)).normalized();
+	return orientation * Vector2(d(1), -d(0));
+}
+
+real EdgeBVH::signed_distance(const Vector2 &p) const {
+	int edge;
+	real d = distance(p, &edge);
+	if (edge < 0) {
+		return -d;
+	}
+
+	// outside if p is in front of the closest edge, or of the corner at the
+	// closest vertex (the sum of the normals of both edges), like the winding
+	// number of a simple polygon. Where that is close to a tie the winding
+	// number decides.
+	int n = points.cols();
+	Vector2 a = this->a(edge), b = this->b(edge);
+	real t = (p - a).dot(b - a) / (b - a).squaredNorm();
+	Vector2 closest, normal;
+	if (t <= 0.) {
+		closest = a;
+		normal = this->normal((edge + n - 1) % n) + this->normal(edge);
+	} else if (t >= 1.) {
+		closest = b;
+		normal = this->normal(edge) + this->normal((edge + 1) % n);
+	} else {
+		closest = a + t*(b - a);
+		normal = this->normal(edge);
+	}
+	real side = normal.dot(p - closest);
+	if (!(std::abs(side) > 1e-9 * d * normal.norm())) {
+		return winding(p) != 0 ? d : -d;
+	}
+	return side < 0. ? d : -d;
+}
+
+real EdgeBVH::raycast(const Vector2 &origin, const Vector2 &dir) const {
+	real best = infinity;
+	if (empty() || dir.isZero()) {
+		return best;
+	}
+	Vector2 d = dir.normalized();
+	Vector2 inv = d.cwiseInverse();
+
+	// parameter range of the ray inside a box, empty if it misses
+	auto enter = [&](const Node &node) {
+		real t_min = 0., t_max = best;
+		for (int k = 0; k < 2; k++) {
+			if (d(k) == 0.) {
+				if (origin(k) < node.lo(k) || origin(k) > node.hi(k)) {
+					return infinity;
+				}
+				continue;
+			}
+			real t0 = (node.lo(k) - origin(k)) * inv(k);
+			real t1 = (node.hi(k) - origin(k)) * inv(k);
+			t_min = std::max(t_min, std::min(t0, t1));
+			t_max = std::min(t_max, std::max(t0, t1));
+		}
+		return t_min <= t_max ? t_min : infinity;
+	};
+
+	int stack[max_depth];
+	int size = 0;
+	if (enter(nodes[0]) < infinity) {
+		stack[size++] = 0;
+	}
+	while (size > 0) {
+		const Node &node = nodes[stack[--size]];
+		if (node.right < 0) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				Vector2 a = this->a(order[k]) - origin, b = this->b(order[k]) - origin;
+				// sides of the end points relative to the ray's line
+				real sa = cross(d, a), sb = cross(d, b);
+				if ((sa > 0. && sb > 0.) || (sa < 0. && sb < 0.)) {
+					continue;
+				}
+				real t;
+				if (sa == 0. && sb == 0.) {
+					// along the ray, hit where the overlap starts
+					real ta = a.dot(d), tb = b.dot(d);
+					if (std::max(ta, tb) < 0.) {
+						continue;
+					}
+					t = std::max(0., std::min(ta, tb));
+				} else {
+					t = (a + sa / (sa - sb) * (b - a)).dot(d);
+				}
+				if (t >= 0. && t < best) {
+					best = t;
+				}
+			}
+			continue;
+		}
+		// nearer child on top of the stack, skipping children behind the best hit
+		int left = &node - nodes.data() + 1;
+		int right = node.right;
+		real t_left = enter(nodes[left]), t_right = enter(nodes[right]);
+		if (t_left < t_right) {
+			std::swap(left, right);
+			std::swap(t_left, t_right);
+		}
+		if (t_left < infinity) {
+			stack[size++] = left;
+		}
+		if (t_right < infinity) {
+			stack[size++] = right;
+		}
+	}
+	return best;
+}
+
+array<real, 2> EdgeBVH::intersect_horizontal(real y) const {
+	array<real, 2> res = {infinity, -infinity};
+	if (empty()) {
+		return res;
+	}
+	int stack[max_depth];
+	int size = 0;
+	stack[size++] = 0;
+	while (size > 0) {
+		const Node &node = nodes[stack[--size]];
+		if (y < node.lo(1) || y > node.hi(1)) {
+			continue;
+		}
+		if (node.right < 0) {
+			for (int k = node.first; k < node.first + node.count; k++) {
+				Vector2 a = this->a(order[k]), b = this->b(order[k]);
+				if ((a(1) > y && b(1) > y) || (a(1) < y && b(1) < y)) {
+					continue;
+				}
+				if (a(1) == b(1)) {
+					res[0] = std::min({res[0], a(0), b(0)});
+					res[1] = std::max({res[1], a(0), b(0)});
+				} else {
+					real x = a(0) + (y - a(1)) / (b(1) - a(1)) * (b(0) - a(0));
+					res[0] = std::min(res[0], x);
+					res[1] = std::max(res[1], x);
+				}
+			}
+			continue;
+		}
+		stack[size++] = &node - nodes.data() + 1;
+		stack[size++] = node.right;
+	}
+	return res;
+}
+
+}
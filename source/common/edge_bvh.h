@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common/common.h"
+
+namespace ruffles {
+
+/// Bounding volume hierarchy over the edges of a closed polygon, for distance,
+/// inside and ray queries in double precision. Edge i goes from point i to point
+/// i+1, the last one back to point 0. Nodes are stored depth first, the left
+/// child of an inner node directly follows it.
+class EdgeBVH {
+public:
+	using Points = Matrix<real, 2, -1>;
+
+	EdgeBVH() = default;
+	explicit EdgeBVH(const Points &polygon);
+
+	bool empty() const;
+
+	/// Distance to the closest edge, infinity for an empty polygon. Sets edge
+	/// to the index of that edge if given.
+	real distance(const Vector2 &p, int *edge = nullptr) const;
+	/// Winding number of the polygon around p
+	int winding(const Vector2 &p) const;
+	/// Distance to the boundary, positive inside. The sign comes from the side
+	/// of the closest edge for simple polygons, from the winding number when
+	/// p is about as close to edges facing different ways.
+	real signed_distance(const Vector2 &p) const;
+
+	/// Distance from origin along the ray in direction dir to the first edge
+	/// it hits, infinity if none. dir doesn't need to be normalized.
+	real raycast(const Vector2 &origin, const Vector2 &dir) const;
+	/// Smallest and largest x where the horizontal line at y meets an edge,
+	/// infinity and -infinity if none
+	array<real, 2> intersect_horizontal(real y) const;
+
+	Vector2 a(int edge) const;
+	Vector2 b(int edge) const;
+
+private:
+	struct Node {
+		Vector2 lo, hi;
+		int first, count; // edges order[first, first+count) of a leaf
+		int right = -1; // right child of an inner node, -1 for leaves
+	};
+	static constexpr int leaf_size = 4;
+
+	int build(int first, int count);
+	// unit normal pointing out of the polygon
+	Vector2 normal(int edge) const;
+
+	Points points;
+	real orientation = 1.; // sign of the area
+	vector<int> order;
+	vector<Node> nodes;
+};
+
+}
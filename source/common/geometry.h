@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common/common.h"
+
+#include <algorithm>
+
+namespace ruffles {
+
+// 2d primitives shared by PolygonIntersection and EdgeBVH, inline since they
+// run in their innermost loops
+
+/// z component of the cross product, positive if b is counter-clockwise of a
+inline real cross(const Vector2 &a, const Vector2 &b) {
+	return a(0)*b(1) - a(1)*b(0);
+}
+
+/// Squared distance from p to the segment from a to b
+inline real segment_distance2(const Vector2 &p, const Vector2 &a, const Vector2 &b) {
+	Vector2 d = b - a;
+	real t = d.squaredNorm() > 0. ? std::clamp((p-a).dot(d) / d.squaredNorm(), 0., 1.) : 0.;
+	return (a + t*d - p).squaredNorm();
+}
+
+/// Contribution of the edge from a to b to the winding number around p: +1 if
+/// it crosses the ray from p to the right going up, -1 going down, else 0
+inline int winding_crossing(const Vector2 &p, const Vector2 &a, const Vector2 &b) {
+	if (a(1) <= p(1)) {
+		return b(1) > p(1) && cross(b - a, p - a) > 0. ? 1 : 0;
+	}
+	return b(1) <= p(1) && cross(b - a, p - a) < 0. ? -1 : 0;
+}
+
+}
@@ -0,0 +1,334 @@
+#include "common/polygon_intersection.h"
+
+#include "common/geometry.h"
+
+#include <algorithm>
+
+namespace ruffles {
+
+namespace {
+
+real extent(const PolygonIntersection::Points &points) {
+	if (points.cols() == 0) {
+		return 0.;
+	}
+	return (points.rowwise().maxCoeff() - points.rowwise().minCoeff()).maxCoeff();
+}
+
+// split parameter t along edge
+struct Split {
+	int edge;
+	real t;
+	bool operator<(const Split &other) const {
+		return edge < other.edge || (edge == other.edge && t < other.t);
+	}
+};
+
+}
+
+real polygon_area(const Matrix<real, 2, -1> &points, Matrix<real, 2, -1> *grad) {
+	real res = 0.;
+	int n = points.cols();
+	for (int i = 0; i < n; i++) {
+		Vector2 a = points.col(i) - points.col(0);
+		Vector2 b = points.col((i+1) % n) - points.col(0);
+		res += 0.5 * cross(a, b);
+	}
+	if (grad) {
+		grad->resize(2, n);
+		for (int i = 0; i < n; i++) {
+			Vector2 d = points.col((i+1) % n) - points.col((i+n-1) % n);
+			grad->col(i) = 0.5 * Vector2(d(1), -d(0));
+		}
+	}
+	return res;
+}
+
+void PolygonIntersection::Ring::build(const Points &points_, real eps_) {
+	points = points_;
+	eps = eps_;
+	int n = size();
+	signed_area = polygon_area(points);
+	if (n == 0) {
+		n_slabs = 0;
+		return;
+	}
+
+	y_min = points.row(1).minCoeff();
+	y_max = points.row(1).maxCoeff();
+	n_slabs = std::max(1, n / 2);
+	slab_scale = y_max > y_min ? n_slabs / (y_max - y_min) : 0.;
+
+	// counting sort of the edges into the slabs
+	slab_start.assign(n_slabs+1, 0);
+	for (int i = 0; i < n; i++) {
+		real lo = std::min(a(i)(1), b(i)(1));
+		real hi = std::max(a(i)(1), b(i)(1));
+		for (int s = slab(lo - eps); s <= slab(hi + eps); s++) {
+			slab_start[s+1]++;
+		}
+	}
+	for (int s = 0; s < n_slabs; s++) {
+		slab_start[s+1] += slab_start[s];
+	}
+	slab_edges.resize(slab_start.back());
+	vector<int> fill(slab_start.begin(), slab_start.end()-1);
+	for (int i = 0; i < n; i++) {
+		real lo = std::min(a(i)(1), b(i)(1));
+		real hi = std::max(a(i)(1), b(i)(1));
+		for (int s = slab(lo - eps); s <= slab(hi + eps); s++) {
+			slab_edges[fill[s]++] = i;
+		}
+	}
+}
+
+int PolygonIntersection::Ring::size() const {
+	return points.cols();
+}
+
+Vector2 PolygonIntersection::Ring::a(int edge) const {
+	return points.col(edge);
+}
+
+Vector2 PolygonIntersection::Ring::b(int edge) const {
+	return points.col(edge+1 < size() ? edge+1 : 0);
+}
+
+int PolygonIntersection::Ring::slab(real y) const {
+	real s = (y - y_min) * slab_scale;
+	return s <= 0. ? 0 : s >= n_slabs ? n_slabs-1 : int(s);
+}
+
+int PolygonIntersection::Ring::winding(const Vector2 &p) const {
+	if (size() == 0 || p(1) < y_min || p(1) > y_max) {
+		return 0;
+	}
+	int res = 0;
+	int s = slab(p(1));
+	for (int k = slab_start[s]; k < slab_start[s+1]; k++) {
+		int i = slab_edges[k];
+		res += winding_crossing(p, a(i), b(i));
+	}
+	return res;
+}
+
+int PolygonIntersection::Ring::touching(const Vector2 &p, const Vector2 &dir) const {
+	int res = -1;
+	real best = -1.;
+	if (size() == 0 || p(1) < y_min - eps || p(1) > y_max + eps) {
+		return res;
+	}
+	for (int s = slab(p(1) - eps); s <= slab(p(1) + eps); s++) {
+		for (int k = slab_start[s]; k < slab_start[s+1]; k++) {
+			int i = slab_edges[k];
+			Vector2 a = this->a(i), b = this->b(i);
+			if ((p.array() < a.cwiseMin(b).array() - eps).any() || (p.array() > a.cwiseMax(b).array() + eps).any()) {
+				continue;
+			}
+			if (segment_distance2(p, a, b) > eps*eps) {
+				continue;
+			}
+			real parallel = std::abs((b - a).normalized().dot(dir));
+			if (parallel > best) {
+				best = parallel;
+				res = i;
+			}
+		}
+	}
+	return res;
+}
+
+
+PolygonIntersection::PolygonIntersection(const Points &polygon) {
+	ring.build(polygon, tolerance * extent(polygon));
+}
+
+real PolygonIntersection::area() const {
+	return ring.signed_area;
+}
+
+const PolygonIntersection::Points &PolygonIntersection::polygon() const {
+	return ring.points;
+}
+
+std::optional<real> PolygonIntersection::intersection_area(const Points &other_points, Points *grad) const {
+	if (ring.size() < 3 || other_points.cols() < 3) {
+		if (grad) {
+			grad->setZero(2, other_points.cols());
+		}
+		return 0.;
+	}
+	real eps = std::max(ring.eps, tolerance * extent(other_points));
+	Ring other;
+	other.build(other_points, eps);
+	const Ring &target = ring;
+
+	// split both boundaries where they cross or touch
+	vector<Split> target_splits, other_splits;
+	auto touch = [&](const Vector2 &p, const Vector2 &a, const Vector2 &b, int edge, vector<Split> &splits) {
+		Vector2 d = b - a;
+		real t = (p - a).dot(d) / d.squaredNorm();
+		real t_eps = eps / d.norm();
+		if (t > t_eps && t < 1.-t_eps && segment_distance2(p, a, b) <= eps*eps) {
+			splits.push_back({edge, t});
+		}
+	};
+	for (int f = 0; f < other.size(); f++) {
+		Vector2 fa = other.a(f), fb = other.b(f);
+		Vector2 f_min = fa.cwiseMin(fb).array() - eps;
+		Vector2 f_max = fa.cwiseMax(fb).array() + eps;
+		real f_length = (fb - fa).norm();
+		if (f_length <= eps || f_max(1) < target.y_min - eps || f_min(1) > target.y_max + eps) {
+			continue;
+		}
+		for (int s = target.slab(f_min(1)); s <= target.slab(f_max(1)); s++) {
+			for (int k = target.slab_start[s]; k < target.slab_start[s+1]; k++) {
+				int e = target.slab_edges[k];
+				Vector2 ea = target.a(e), eb = target.b(e);
+				Vector2 e_min = ea.cwiseMin(eb).array() - eps;
+				Vector2 e_max = ea.cwiseMax(eb).array() + eps;
+				if ((e_min.array() > f_max.array()).any() || (f_min.array() > e_max.array()).any()) {
+					continue;
+				}
+				// each pair only in the lowest slab both are listed in
+				if (target.slab(std::max(e_min(1), f_min(1))) != s) {
+					continue;
+				}
+				real e_length = (eb - ea).norm();
+				if (e_length <= eps) {
+					continue;
+				}
+
+				// signed distances of the end points to the other line
+				real da = cross(fb - fa, ea - fa) / f_length;
+				real db = cross(fb - fa, eb - fa) / f_length;
+				real dc = cross(eb - ea, fa - ea) / e_length;
+				real dd = cross(eb - ea, fb - ea) / e_length;
+				bool e_crosses = (da > eps && db < -eps) || (da < -eps && db > eps);
+				bool f_crosses = (dc > eps && dd < -eps) || (dc < -eps && dd > eps);
+				if (e_crosses && f_crosses) {
+					target_splits.push_back({e, da / (da - db)});
+					other_splits.push_back({f, dc / (dc - dd)});
+				} else {
+					// end points on the other edge, also covers overlaps
+					touch(fa, ea, eb, e, target_splits);
+					touch(fb, ea, eb, e, target_splits);
+					touch(ea, fa, fb, f, other_splits);
+					touch(eb, fa, fb, f, other_splits);
+				}
+			}
+		}
+	}
+	std::sort(target_splits.begin(), target_splits.end());
+	std::sort(other_splits.begin(), other_splits.end());
+
+	// pieces of this boundary inside other, and of other inside this. Pieces
+	// on both boundaries count for this one if the interiors are on the
+	// same side, and never for other.
+	Vector2 origin = target.points.col(0);
+	real target_sign = target.signed_area < 0. ? -1. : 1.;
+	real other_sign = other.signed_area < 0. ? -1. : 1.;
+	bool degenerate = false;
+	auto boundary_integral = [&](const Ring &ring, const Ring &inside, const vector<Split> &splits, bool count_shared, Points *grad) {
+		real res = 0.;
+		real sign = &ring == &target ? target_sign : other_sign;
+		// the part of edge i between t0 and t1
+		auto piece = [&](int i, real t0, real t1) {
+			Vector2 edge_a = ring.a(i), edge_b = ring.b(i);
+			Vector2 a = edge_a + t0*(edge_b - edge_a), b = edge_a + t1*(edge_b - edge_a);
+			Vector2 d = b - a;
+			if (d.norm() <= eps) {
+				return;
+			}
+			Vector2 center = 0.5*(a + b);
+			Vector2 dir = d.normalized();
+			int shared = inside.touching(center, dir);
+			if (shared >= 0) {
+				Vector2 shared_dir = (inside.b(shared) - inside.a(shared)).normalized();
+				if (std::abs(cross(dir, shared_dir)) > 1e-6) {
+					// crosses right at the center, the splits missed it
+					degenerate = true;
+					return;
+				}
+				real inside_sign = &inside == &target ? target_sign : other_sign;
+				if (!count_shared || sign*dir.dot(inside_sign*shared_dir) < 0.) {
+					return;
+				}
+			} else if (inside.winding(center) == 0) {
+				return;
+			}
+			res += 0.5 * sign * cross(a - origin, b - origin);
+			if (grad) {
+				// moving the piece along its outward normal grows the area by
+				// its length, the end points of the edge move it linearly in t
+				Vector2 e = edge_b - edge_a;
+				Vector2 normal = sign * Vector2(e(1), -e(0));
+				real w_b = 0.5*(t1*t1 - t0*t0);
+				grad->col(i) += (t1 - t0 - w_b) * normal;
+				grad->col(i+1 < ring.size() ? i+1 : 0) += w_b * normal;
+			}
+		};
+		auto split = splits.begin();
+		for (int i = 0; i < ring.size(); i++) {
+			real last_t = 0.;
+			real t_eps = eps / std::max(eps, (ring.b(i) - ring.a(i)).norm());
+			for (; split != splits.end() && split->edge == i; ++split) {
+				if (split->t - last_t <= t_eps) {
+					continue;
+				}
+				piece(i, last_t, split->t);
+				last_t = split->t;
+			}
+			piece(i, last_t, 1.);
+		}
+		return res;
+	};
+	if (grad) {
+		grad->setZero(2, other.size());
+	}
+	real res = boundary_integral(target, other, target_splits, true, nullptr)
+	         + boundary_integral(other, target, other_splits, false, grad);
+	if (degenerate) {
+		if (grad) {
+			grad->setZero();
+		}
+		return std::nullopt;
+	}
+
+	// the pieces dropped for being shorter than eps leave an error of about
+	// eps times the size per piece
+	real size = std::max(extent(target.points), extent(other.points));
+	real slack = 10. * eps * size * (target.size() + other.size());
+	real max_area = std::min(std::abs(target.signed_area), std::abs(other.signed_area));
+	if (res < -slack || res > max_area + slack) {
+		if (grad) {
+			grad->setZero();
+		}
+		return std::nullopt;
+	}
+
+	// clamped, the gradient is that of the clamped value
+	if (res < 0.) {
+		if (grad) {
+			grad->setZero();
+		}
+		return 0.;
+	}
+	if (res > max_area) {
+		if (grad) {
+			if (std::abs(other.signed_area) <= std::abs(target.signed_area)) {
+				// other lies inside, its area is the intersection
+				polygon_area(other.points, grad);
+				if (other.signed_area < 0.) {
+					*grad *= -1.;
+				}
+			} else {
+				grad->setZero();
+			}
+		}
+		return max_area;
+	}
+	return res;
+}
+
+}
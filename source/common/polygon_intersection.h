@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common/common.h"
+
+#include <optional>
+
+namespace ruffles {
+
+/// Signed area of a closed ring of points, positive for counter-clockwise,
+/// and its gradient with respect to the points if given
+real polygon_area(const Matrix<real, 2, -1> &points, Matrix<real, 2, -1> *grad = nullptr);
+
+/// Area of the intersection of a fixed polygon with others, in double
+/// precision. Polygons are closed rings of points (one per column), their
+/// interior follows the nonzero winding rule, so either orientation works
+/// and rings may touch themselves.
+/// The boundary of the intersection consists of the pieces of each boundary
+/// that lie inside the other polygon. Both boundaries are split where they
+/// meet, every piece is classified by its midpoint and the area follows from
+/// the shoelace formula over the pieces inside. Pieces shared by both
+/// boundaries count once if the interiors lie on the same side.
+/// The edges of the fixed polygon are bucketed into horizontal slabs once.
+class PolygonIntersection {
+public:
+	using Points = Matrix<real, 2, -1>;
+
+	PolygonIntersection() = default;
+	explicit PolygonIntersection(const Points &polygon);
+
+	// signed, positive for counter-clockwise polygons
+	real area() const;
+	const Points &polygon() const;
+
+	/// Area of the intersection with other, none if the boundaries touch in a
+	/// way that double precision can't classify, e.g. crossing at a
+	/// shallow angle right at a vertex. With grad, also the gradient of the
+	/// area with respect to the points of other, from the pieces of its
+	/// boundary inside this polygon, or zero if there is no area.
+	std::optional<real> intersection_area(const Points &other, Points *grad = nullptr) const;
+
+	/// Relative to the size of both polygons, distance below which points
+	/// count as touching
+	real tolerance = 1e-9;
+
+private:
+	// edges of a closed ring, edge i goes from point i to point i+1, bucketed
+	// into the horizontal slabs their y range (grown by eps) overlaps
+	struct Ring {
+		Points points;
+		real signed_area = 0.;
+		real y_min = 0., y_max = 0.;
+		real eps = 0.;
+		int n_slabs = 0;
+		real slab_scale = 0.; // slabs per unit of y
+		vector<int> slab_start; // edges of slab s are slab_edges[slab_start[s], slab_start[s+1])
+		vector<int> slab_edges;
+
+		void build(const Points &points, real eps);
+		int size() const;
+		Vector2 a(int edge) const;
+		Vector2 b(int edge) const;
+		// clamped to [0, n_slabs)
+		int slab(real y) const;
+		int winding(const Vector2 &p) const;
+		// edge within eps of p that is most parallel to dir, -1 if none
+		int touching(const Vector2 &p, const Vector2 &dir) const;
+	};
+
+	Ring ring;
+};
+
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ruffles {
+
+/// Replacement for std::list in the Ruffle and SimulationMesh topology.
+/// Elements live in chunks of contiguous slots that never move, so iterators
+/// and element pointers stay valid like those of a std::list, also when the
+/// container itself is moved. Erased slots are reused through a free list,
+/// each reuse bumps the generation of the slot so that stale iterators are
+/// caught in debug builds. The order is kept by links between the slots:
+/// iteration follows insertion (strip) order, insert and erase are O(1).
+/// Slot indices are dense, index() of an iterator can address a plain
+/// vector of size capacity() instead of a hash map.
+/// Copies keep the slot indices of the original.
+// index() of the element with the given iterator id()
+inline int slot_index_of_id(uint64_t id) {
+	return int(id & 0xffffffffu);
+}
+
+template<typename T>
+class slot_list {
+	struct Node {
+		Node *prev = nullptr;
+		Node *next = nullptr;
+		uint32_t generation = 0;
+		int index = -1; // -1 for the sentinel
+		bool alive = false;
+		alignas(T) unsigned char storage[sizeof(T)];
+
+		T &value() {
+			return *std::launder(reinterpret_cast<T *>(storage));
+		}
+	};
+	static constexpr int chunk_size = 64;
+
+public:
+	template<bool Const>
+	class iterator_impl {
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<Const, const T *, T *>;
+		using reference = std::conditional_t<Const, const T &, T &>;
+
+		iterator_impl() = default;
+		// iterator to const_iterator
+		template<bool C = Const, typename = std::enable_if_t<C>>
+		iterator_impl(const iterator_impl<false> &other) : node(other.node), generation(other.generation) {}
+
+		reference operator*() const {
+			assert(node && node->alive && node->generation == generation);
+			return node->value();
+		}
+		pointer operator->() const {
+			return &**this;
+		}
+
+		iterator_impl &operator++() {
+			node = node->next;
+			generation = node->generation;
+			return *this;
+		}
+		iterator_impl operator++(int) {
+			iterator_impl res = *this;
+			++*this;
+			return res;
+		}
+		iterator_impl &operator--() {
+			node = node->prev;
+			generation = node->generation;
+			return *this;
+		}
+		iterator_impl operator--(int) {
+			iterator_impl res = *this;
+			--*this;
+			return res;
+		}
+
+		template<bool C>
+		bool operator==(const iterator_impl<C> &other) const {
+			return node == other.node;
+		}
+		template<bool C>
+		bool operator!=(const iterator_impl<C> &other) const {
+			return node != other.node;
+		}
+
+		// slot of the element, in [0, capacity())
+		int index() const {
+			return node->index;
+		}
+		// slot and generation, tells apart elements that reused a slot
+		uint64_t id() const {
+			return uint64_t(generation) << 32 | uint32_t(node->index);
+		}
+
+	private:
+		friend class slot_list;
+		template<bool> friend class iterator_impl;
+
+		explicit iterator_impl(Node *node) : node(node), generation(node ? node->generation : 0) {}
+
+		Node *node = nullptr;
+		uint32_t generation = 0;
+	};
+
+	using value_type = T;
+	using iterator = iterator_impl<false>;
+	using const_iterator = iterator_impl<true>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	slot_list() : head(new Node()) {
+		head->prev = head->next = head.get();
+	}
+
+	slot_list(const slot_list &other) : slot_list() {
+		*this = other;
+	}
+
+	slot_list(slot_list &&other) noexcept {
+		swap(other);
+	}
+
+	slot_list &operator=(const slot_list &other) {
+		if (this == &other) {
+			return *this;
+		}
+		clear();
+		reserve(other.capacity());
+		// same slots as other, linked in the same order
+		for (auto it = other.begin(); it != other.end(); ++it) {
+			Node *node = node_at(it.index());
+			new (node->storage) T(*it);
+			node->alive = true;
+			node->generation++;
+			link(head.get(), node);
+			count++;
+		}
+		free = nullptr;
+		for (int i = capacity()-1; i >= 0; i--) {
+			Node *node = node_at(i);
+			if (!node->alive) {
+				node->next = free;
+				free = node;
+			}
+		}
+		return *this;
+	}
+
+	slot_list &operator=(slot_list &&other) noexcept {
+		slot_list(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	~slot_list() {
+		if (head) {
+			clear();
+		}
+	}
+
+	void swap(slot_list &other) noexcept {
+		std::swap(head, other.head);
+		std::swap(chunks, other.chunks);
+		std::swap(free, other.free);
+		std::swap(count, other.count);
+	}
+
+	iterator begin() { return iterator(head ? head->next : nullptr); }
+	iterator end() { return iterator(head.get()); }
+	const_iterator begin() const { return const_iterator(head ? head->next : nullptr); }
+	const_iterator end() const { return const_iterator(head.get()); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	T &front() { return *begin(); }
+	T &back() { return *std::prev(end()); }
+	const T &front() const { return *begin(); }
+	const T &back() const { return *std::prev(end()); }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	// number of slots, upper bound for index()
+	int capacity() const { return chunks.size() * chunk_size; }
+
+	// iterator to the element in slot index, which must be in use
+	iterator at_index(int index) {
+		Node *node = node_at(index);
+		assert(node->alive);
+		return iterator(node);
+	}
+	const_iterator at_index(int index) const {
+		Node *node = node_at(index);
+		assert(node->alive);
+		return const_iterator(node);
+	}
+
+	template<typename... Args>
+	iterator emplace(const_iterator position, Args &&... args) {
+		Node *node = allocate();
+		try {
+			new (node->storage) T(std::forward<Args>(args)...);
+		} catch (...) {
+			release(node);
+			throw;
+		}
+		link(position.node, node);
+		return iterator(node);
+	}
+	iterator insert(const_iterator position, const T &value) {
+		return emplace(position, value);
+	}
+	iterator insert(const_iterator position, T &&value) {
+		return emplace(position, std::move(value));
+	}
+	template<typename... Args>
+	T &emplace_back(Args &&... args) {
+		return *emplace(end(), std::forward<Args>(args)...);
+	}
+	void push_back(const T &value) {
+		emplace(end(), value);
+	}
+	void push_back(T &&value) {
+		emplace(end(), std::move(value));
+	}
+	template<typename... Args>
+	T &emplace_front(Args &&... args) {
+		return *emplace(begin(), std::forward<Args>(args)...);
+	}
+	void push_front(const T &value) {
+		emplace(begin(), value);
+	}
+
+	iterator erase(const_iterator position) {
+		Node *node = position.node;
+		assert(node->alive && node->generation == position.generation);
+		Node *next = node->next;
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->value().~T();
+		release(node);
+		return iterator(next);
+	}
+	iterator erase(const_iterator first, const_iterator last) {
+		while (first != last) {
+			first = erase(first);
+		}
+		return iterator(last.node);
+	}
+	void pop_back() {
+		erase(std::prev(end()));
+	}
+	void pop_front() {
+		erase(begin());
+	}
+
+	void clear() {
+		if (!head) {
+			head.reset(new Node());
+			head->prev = head->next = head.get();
+		}
+		while (!empty()) {
+			pop_back();
+		}
+	}
+
+	// makes room for slots [0, n) without allocating on insert
+	void reserve(int n) {
+		while (capacity() < n) {
+			add_chunk();
+		}
+	}
+
+private:
+	Node *node_at(int index) const {
+		assert(index >= 0 && index < capacity());
+		return &chunks[index / chunk_size][index % chunk_size];
+	}
+
+	void add_chunk() {
+		int first = capacity();
+		chunks.emplace_back(new Node[chunk_size]);
+		Node *chunk = chunks.back().get();
+		// lowest slots come first off the free list, so that a list built
+		// front to back is also laid out front to back
+		for (int i = chunk_size-1; i >= 0; i--) {
+			chunk[i].index = first + i;
+			chunk[i].next = free;
+			free = &chunk[i];
+		}
+	}
+
+	Node *allocate() {
+		if (!free) {
+			add_chunk();
+		}
+		Node *node = free;
+		free = node->next;
+		node->alive = true;
+		node->generation++;
+		count++;
+		return node;
+	}
+
+	void release(Node *node) {
+		node->alive = false;
+		node->generation++;
+		node->prev = nullptr;
+		node->next = free;
+		free = node;
+		count--;
+	}
+
+	// inserts node before position
+	void link(Node *position, Node *node) {
+		node->next = position;
+		node->prev = position->prev;
+		position->prev->next = node;
+		position->prev = node;
+	}
+
+	std::unique_ptr<Node> head; // sentinel, next is the first and prev the last element
+	std::vector<std::unique_ptr<Node[]>> chunks;
+	Node *free = nullptr; // singly linked through next
+	size_t count = 0;
+};
+
+}
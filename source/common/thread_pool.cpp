@@ -0,0 +1,173 @@
+#include "common/thread_pool.h"
+
+namespace ruffles {
+
+namespace {
+thread_local bool inside_pool = false;
+}
+
+ThreadPool::ThreadPool(int n_threads) {
+	for (int i = 1; i < n_threads; i++) {
+		workers.emplace_back([this]() { work(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	start.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+int ThreadPool::size() const {
+	return workers.size() + 1;
+}
+
+ThreadPool &ThreadPool::global() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::run_chunks(const std::function<void(int, int, int)> &f, int n, int chunks) {
+	bool was_inside = inside_pool;
+	inside_pool = true;
+	for (int chunk = next_chunk++; chunk < chunks; chunk = next_chunk++) {
+		int begin = (long)n * chunk / chunks;
+		int end = (long)n * (chunk+1) / chunks;
+		f(chunk, begin, end);
+	}
+	inside_pool = was_inside;
+}
+
+void ThreadPool::work() {
+	long seen = 0;
+	while (true) {
+		const std::function<void(int, int, int)> *f;
+		int n, chunks;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+			if (!job) {
+				// woke up after the loop was already finished
+				continue;
+			}
+			f = job;
+			n = job_size;
+			chunks = n_chunks;
+			busy_workers++;
+		}
+		run_chunks(*f, n, chunks);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy_workers--;
+		}
+		done.notify_one();
+	}
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int, int, int)> &f) {
+	if (n <= 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> own(owner, std::defer_lock);
+	if (workers.empty() || n == 1 || inside_pool || !own.try_lock()) {
+		f(0, 0, n);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &f;
+		job_size = n;
+		n_chunks = std::min(n, size());
+		next_chunk = 0;
+		generation++;
+	}
+	start.notify_all();
+
+	run_chunks(f, n, std::min(n, size()));
+
+	// workers that joined late find no chunks left and leave immediately
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&]() { return busy_workers == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::parallel_tasks(int n, const std::function<void(int)> &f) {
+	if (n <= 0) {
+		return;
+	}
+	// tasks [begin, end) are left in a share, the owner takes them from the
+	// front and thieves from the back
+	struct Share {
+		std::mutex mutex;
+		int begin = 0;
+		int end = 0;
+	};
+	int n_shares = std::min(n, size());
+	vector<Share> shares(n_shares);
+	for (int i = 0; i < n_shares; i++) {
+		shares[i].begin = (long)n * i / n_shares;
+		shares[i].end = (long)n * (i+1) / n_shares;
+	}
+
+	auto steal = [&](int thief) {
+		while (true) {
+			int victim = -1;
+			int most = 0;
+			for (int i = 0; i < n_shares; i++) {
+				std::lock_guard<std::mutex> lock(shares[i].mutex);
+				if (i != thief && shares[i].end - shares[i].begin > most) {
+					victim = i;
+					most = shares[i].end - shares[i].begin;
+				}
+			}
+			if (victim < 0) {
+				return false;
+			}
+			int begin, end;
+			{
+				std::lock_guard<std::mutex> lock(shares[victim].mutex);
+				end = shares[victim].end;
+				begin = shares[victim].begin + (end - shares[victim].begin) / 2;
+				shares[victim].end = begin;
+			}
+			if (begin < end) {
+				std::lock_guard<std::mutex> lock(shares[thief].mutex);
+				shares[thief].begin = begin;
+				shares[thief].end = end;
+				return true;
+			}
+			// someone else was faster, look again
+		}
+	};
+
+	// a thread may run several shares one after the other if the others are
+	// late, or all of them if the loop runs serially
+	parallel_for(n_shares, [&](int share, int, int) {
+		while (true) {
+			int task = -1;
+			{
+				std::lock_guard<std::mutex> lock(shares[share].mutex);
+				if (shares[share].begin < shares[share].end) {
+					task = shares[share].begin++;
+				}
+			}
+			if (task >= 0) {
+				f(task);
+			} else if (!steal(share)) {
+				return;
+			}
+		}
+	});
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common/common.h"
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace ruffles {
+
+/// Fixed set of worker threads for data parallel loops. The calling thread
+/// works on chunks as well. Calls from inside a running loop, or while another
+/// thread owns the pool, run serially on the caller instead of blocking.
+class ThreadPool {
+public:
+	explicit ThreadPool(int n_threads = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// number of threads working on a loop, including the caller
+	int size() const;
+
+	// splits [0, n) into at most size() contiguous chunks and calls
+	// f(chunk, begin, end) for each of them, returns when all are done
+	void parallel_for(int n, const std::function<void(int, int, int)> &f);
+
+	// calls f(task) for every task in [0, n), for independent tasks of very
+	// different cost. Every thread starts on its own contiguous share of the
+	// tasks and steals half of the largest remaining share when it runs out.
+	void parallel_tasks(int n, const std::function<void(int)> &f);
+
+	static ThreadPool &global();
+
+private:
+	void work();
+	void run_chunks(const std::function<void(int, int, int)> &f, int n, int chunks);
+
+	vector<std::thread> workers;
+
+	std::mutex owner; // held by the thread running a loop
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+	long generation = 0;
+	bool stopping = false;
+
+	const std::function<void(int, int, int)> *job = nullptr;
+	int job_size = 0;
+	int n_chunks = 0;
+	std::atomic<int> next_chunk {0};
+	int busy_workers = 0;
+};
+
+}
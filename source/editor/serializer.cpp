@@ -1,6 +1,11 @@
 #include "editor/serializer.h"
 #include <igl/serialize.h>
 
+#include "simulation/lbfgs.h"
+#include "editor/utils/logger.h"
+
+#include <stdexcept>
+
 
 namespace ruffles::model {
 
@@ -51,7 +56,7 @@ void Serializer::deserialize(const std::string& scene_file, DataModel& data_mode
 	{
 		Mesh sub_mesh;
 		igl::deserialize(sub_mesh, "sub_mesh_" + to_string(i), scene_file);
-		data_model.parts.emplace_back(sub_mesh);
+		data_model.parts.emplace_back(sub_mesh, false);
 
 		ModelPart& part = data_model.parts[i];
 
@@ -63,13 +68,25 @@ void Serializer::deserialize(const std::string& scene_file, DataModel& data_mode
 		igl::deserialize(ground_plane, "ground_plane_" + to_string(i), scene_file);
 		part._ground_plane = ground_plane;
 
+		Ruffle ruffle;
+		try {
+			igl::deserialize(ruffle, "ruffle_" + to_string(i), scene_file);
+		} catch (std::runtime_error &e) {
+			// Ruffle::Deserialize leaves the ruffle empty, it is generated anew
+			write_log(1) << "error at loading ruffle " << i << ": " << e.what() << std::endl;
+		}
+
+		// scenes saved before ruffles were serialized come with empty ones,
+		// which have to be generated and solved again
+		bool saved_ruffle = !ruffle.sections.empty();
 		Eigen::MatrixXd cutline;
 		igl::deserialize(cutline, "cutline_" + to_string(i), scene_file);
-		part.cutline(cutline);
+		part.cutline(cutline, !saved_ruffle);
 
-		Ruffle ruffle;
-		igl::deserialize(ruffle, "ruffle_" + to_string(i), scene_file);
-		part.ruffle(std::move(ruffle));
+		if (saved_ruffle) {
+			ruffle.simulator.reset(new simulation::LBFGS(ruffle.simulation_mesh));
+			part.ruffle(std::move(ruffle));
+		}
 	}
 }
 
@@ -9,6 +9,12 @@
 #include "common/imgui.h"
 #include "output/create_svg.h"
 
+#include "simulation/lbfgs.h"
+#include "simulation/newton.h"
+#include "simulation/combination.h"
+#include "simulation/projective_dynamics.h"
+#include "simulation/mixed_precision.h"
+
 
 namespace ruffles::editor {
 
@@ -90,10 +96,50 @@ void RuffleOptimizer::update_menu(Menu& menu)
 		has_changed = true;
 	}
 
+	if (ImGui::Button("Optimize lengths (adjoint)")) {
+		optimization::Adjoint adjoint(part->target());
+		adjoint.optimize(part->ruffle());
+		has_changed = true;
+	}
+
+	const char *simulators[] = {"LBFGS", "Newton", "LBFGS + Verlet", "Projective Dynamics", "Mixed precision LBFGS"};
+	if (ImGui::Combo("Simulator", &simulator_type, simulators, IM_ARRAYSIZE(simulators))) {
+		auto &mesh = part->ruffle().simulation_mesh;
+		switch (simulator_type) {
+			case 0: part->ruffle().simulator.reset(new simulation::LBFGS(mesh)); break;
+			case 1: part->ruffle().simulator.reset(new simulation::Newton(mesh)); break;
+			case 2: part->ruffle().simulator.reset(new simulation::Combination(mesh)); break;
+			case 3: part->ruffle().simulator.reset(new simulation::ProjectiveDynamics(mesh)); break;
+			case 4: part->ruffle().simulator.reset(new simulation::MixedPrecision(mesh)); break;
+		}
+	}
+	if (part->ruffle().simulator) {
+		part->ruffle().simulator->menu_callback();
+	}
+
 	if (ImGui::Button("Physics solve")) {
 		part->ruffle().physics_solve();
 		has_changed = true;
 	}
+	if (ImGui::TreeNode("Solve settings")) {
+		auto &settings = part->ruffle().solve_settings;
+		ImGui::InputInt("max steps", &settings.max_steps);
+		ImGui::InputReal("gradient tolerance", &settings.gradient_tolerance);
+		ImGui::InputReal("energy tolerance", &settings.energy_tolerance);
+		ImGui::InputReal("max time (s)", &settings.max_time);
+		ImGui::InputInt("multires levels", &part->ruffle().multires_levels);
+		ImGui::TreePop();
+	}
+	{
+		const auto &report = part->ruffle().last_solve_report;
+		ImGui::Text("Last solve: %s after %d steps", report.stop_name(), report.steps);
+		ImGui::Text("Evaluations: %d energy, %d gradient", report.energy_evaluations, report.gradient_evaluations);
+		ImGui::Text("Air mesh: %d of %d relaxations flipped", report.relax_flips, report.relax_calls);
+		ImGui::Text("Energy %.6g, |projected gradient| %.3g", report.energy, report.gradient_norm);
+		ImGui::Text("Time %.3fs: energy %.3fs, relax %.3fs, coarse %.3fs, solver %.3fs",
+			report.total_time, report.energy_time, report.relax_time, report.coarse_time, report.solver_time);
+		ImGui::Text("Line searches %.3fs, energy included", report.line_search_time);
+	}
 
 	if (ImGui::Button("(Re-)Generate air mesh")) {
 		part->ruffle().simulation_mesh.generate_air_mesh();
@@ -124,6 +170,8 @@ void RuffleOptimizer::update_menu(Menu& menu)
 		ImGui::InputDouble("k_M", &part->ruffle().simulation_mesh.lambda_membrane);
 		ImGui::InputDouble("k_B", &part->ruffle().simulation_mesh.k_bend);
 		ImGui::InputDouble("k_AM", &part->ruffle().simulation_mesh.lambda_air_mesh);
+		ImGui::Checkbox("Air mesh barrier", &part->ruffle().simulation_mesh.use_barrier);
+		ImGui::Checkbox("Incremental air mesh", &part->ruffle().simulation_mesh.incremental_air_mesh);
 
 		ImGui::Separator();
 
@@ -5,6 +5,7 @@
 #include "model/plane.h"
 
 #include "optimization/heuristic.h"
+#include "optimization/adjoint.h"
 
 using namespace ruffles::model;
 namespace ruffles::editor {
@@ -28,6 +29,7 @@ private:
 	ModelPart* part = NULL;
 	std::vector<int> view_indices;
 	int ruffle_mesh_view_index = -1;
+	int simulator_type = 0;
 
 
 	void update_part_view(igl::opengl::glfw::Viewer& viewer, int part_index);
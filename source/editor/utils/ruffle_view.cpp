@@ -12,12 +12,12 @@ Mesh ruffle_mesh(ModelPart& part)
 	auto& target = part.target();
 
 	using ruffles::simulation::SimulationMesh;
-	std::unordered_map<listref<SimulationMesh::Vertex>, int, listref_hash<SimulationMesh::Vertex>> indices;
+	vector<int> indices(mesh.vertices.capacity(), -1);
 
 	MatrixX V(2 * mesh.vertices.size(), 3);
 	int i = 0;
 	for (auto it = mesh.vertices.begin(); it != mesh.vertices.end(); ++it, i++) {
-		indices.emplace(it, i);
+		indices[it.index()] = i;
 		Vector2 uv = mesh.get_vertex_position(*it);
 		Vector3 xyz = target.origin + uv(0) * target.u_dir + uv(1) * target.v_dir;
 		Vector3 n = target.u_dir.cross(target.v_dir);
@@ -31,8 +31,8 @@ Mesh ruffle_mesh(ModelPart& part)
 	MatrixXi F(2 * mesh.segments.size(), 3);
 	i = 0;
 	for (auto& seg : mesh.segments) {
-		int a = indices[seg.start];
-		int b = indices[seg.end];
+		int a = indices[seg.start.index()];
+		int b = indices[seg.end.index()];
 		F.row(2 * i + 0) << 2 * a, 2 * b, 2 * b + 1;
 		F.row(2 * i + 1) << 2 * b + 1, 2 * a + 1, 2 * a;
 		i++;
@@ -14,7 +14,7 @@ namespace ruffles::model {
     using simulation::LBFGS;
     using simulation::Combination;
 
-    ModelPart::ModelPart(Mesh& segment) : _segment(segment)
+    ModelPart::ModelPart(Mesh& segment, bool init_ruffle) : _segment(segment)
     {
         _plane.align(_segment.V());
         _plane.translate_N=0.01;
@@ -32,7 +32,7 @@ namespace ruffles::model {
         _ground_plane.translate_N = t_min+0.01;
         _ground_plane.update_translation();
         auto x = _plane.cut(_segment);
-        cutline(x);
+        cutline(x, init_ruffle);
     }
 
 
@@ -53,7 +53,7 @@ namespace ruffles::model {
         return target_shape.V;
     }
 
-    void ModelPart::cutline(Eigen::MatrixXd& value)
+    void ModelPart::cutline(Eigen::MatrixXd& value, bool init_ruffle)
     {
         assert(value.rows() > 0);
         Vector3 origin = value.row(0).transpose(); // temporary origin
@@ -122,11 +122,12 @@ namespace ruffles::model {
         stack_count = max(1, round(height / (0.5*step_width)));
         step_height = height/stack_count;
         
-        reinit_ruffle();
+        if (init_ruffle) {
+            reinit_ruffle();
 
- 
-        //_ruffle.simulator.reset(new Combination(_ruffle.simulation_mesh));
-        _ruffle.physics_solve();
+            //_ruffle.simulator.reset(new Combination(_ruffle.simulation_mesh));
+            _ruffle.physics_solve();
+        }
 
         heuristic = optimization::Heuristic(target_shape);
     }
@@ -175,6 +176,8 @@ namespace ruffles::model {
             }
         }
         mesh.interpolate_missing_z();
+        // the masses depend on the widths
+        mesh.update_vertex_mass();
     }
 
     TargetShape& ModelPart::target()
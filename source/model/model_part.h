@@ -16,7 +16,9 @@ namespace ruffles::model {
 	public:
 		friend class Serializer;
 
-		ModelPart(Mesh& segment);
+		/// Without init_ruffle, the ruffle stays empty until it is set, e.g.
+		/// by the Serializer
+		ModelPart(Mesh& segment, bool init_ruffle = true);
 		// shut up c++
     	ModelPart(ModelPart&&) = default;
 		virtual ~ModelPart() { };
@@ -25,7 +27,7 @@ namespace ruffles::model {
 		void segment(Mesh& value); //recut outline with reference plane (if exists)
 
 		Eigen::MatrixXd& cutline();
-		void cutline(Eigen::MatrixXd& value); //re-init ruffle (?)
+		void cutline(Eigen::MatrixXd& value, bool init_ruffle = true); //re-init ruffle (?)
 
 		optimization::TargetShape &target(); //TODO rename, confusing with data_model.target()
 		Ruffle &ruffle();
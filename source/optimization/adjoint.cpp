@@ -0,0 +1,157 @@
+#include "optimization/adjoint.h"
+
+namespace ruffles::optimization {
+
+Adjoint::Adjoint() {
+	param.max_iterations = 50;
+}
+
+Adjoint::Adjoint(TargetShape target)
+ : target(std::move(target)) {
+	param.max_iterations = 50;
+}
+
+real Adjoint::gradient(Ruffle &ruffle, VectorX &grad) {
+	simulation::SimulationMesh &mesh = ruffle.simulation_mesh;
+	const int n = mesh.dof();
+
+	VectorX target_grad;
+	real res = target.energy(ruffle, &target_grad);
+
+	// at equilibrium grad E(x, l) = 0, so dx/dl = -H^-1 dgrad/dl and
+	// dJ/dl = -(H^-1 dJ/dx)^T dgrad/dl. Variables held at a bound stay there
+	// for small changes, like the active set of Newton.
+	VectorX lb = mesh.lb.replicate(n/2, 1);
+	VectorX ub = mesh.ub.replicate(n/2, 1);
+	VectorX energy_grad = VectorX::Zero(n);
+	mesh.energy(mesh.x, &energy_grad);
+	VectorXb active(n);
+	for (int i = 0; i < n; i++) {
+		active(i) = (mesh.x(i) <= lb(i) && energy_grad(i) > 0.)
+		         || (mesh.x(i) >= ub(i) && energy_grad(i) < 0.);
+	}
+
+	vector<Eigen::Triplet<real>> triplets;
+	mesh.hessian(mesh.x, triplets, false);
+	for (auto &t : triplets) {
+		if (active(t.row()) || active(t.col())) {
+			t = Eigen::Triplet<real>(t.row(), t.col(), 0.);
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		triplets.emplace_back(i, i, active(i) ? 1. : 0.);
+	}
+	Eigen::SparseMatrix<real> hessian(n, n);
+	hessian.setFromTriplets(triplets.begin(), triplets.end());
+
+	VectorX rhs = target_grad;
+	for (int i = 0; i < n; i++) {
+		if (active(i)) rhs(i) = 0.;
+	}
+
+	// shift the diagonal if the equilibrium is not quite a minimum
+	Eigen::SimplicialLDLT<Eigen::SparseMatrix<real>> solver;
+	real diagonal_scale = max(1., hessian.diagonal().cwiseAbs().maxCoeff());
+	real regularization = 0.;
+	VectorX adjoint;
+	for (int attempt = 0; attempt < 20; attempt++) {
+		Eigen::SparseMatrix<real> shifted = hessian;
+		for (int i = 0; i < n; i++) {
+			if (!active(i)) shifted.coeffRef(i, i) += regularization * diagonal_scale;
+		}
+		solver.compute(shifted);
+		if (solver.info() == Eigen::Success) {
+			adjoint = solver.solve(rhs);
+			if (adjoint.allFinite()) {
+				break;
+			}
+		}
+		adjoint.resize(0);
+		regularization = max(1e-10, 10. * regularization);
+	}
+	if (adjoint.size() == 0) {
+		adjoint.setZero(n);
+	}
+	VectorX segment_grad = -(mesh.length_jacobian(mesh.x).transpose() * adjoint);
+
+	// the segments are compiled in list order
+	vector<int> segment_index(mesh.segments.capacity(), -1);
+	int compiled_index = 0;
+	for (auto seg = mesh.segments.begin(); seg != mesh.segments.end(); ++seg) {
+		segment_index[seg.index()] = compiled_index++;
+	}
+	assert(compiled_index == segment_grad.size());
+
+	// every mesh segment of a section is section.length / N long
+	grad.setZero(ruffle.sections.size());
+	int i = 0;
+	for (auto &section : ruffle.sections) {
+		for (auto &seg : section.mesh_segments) {
+			grad(i) += segment_grad(segment_index[seg.index()]) / section.mesh_segments.size();
+		}
+		i++;
+	}
+	return res;
+}
+
+int Adjoint::optimize(Ruffle &ruffle) {
+	int m = ruffle.sections.size();
+	VectorX lengths(m);
+	int i = 0;
+	for (auto &section : ruffle.sections) {
+		lengths(i++) = max(section.length, min_length);
+	}
+	// like ParticleSwarm, stay within half and one and a half times the
+	// current lengths. Further away the ruffle may not settle at all.
+	VectorX lb = (0.5 * lengths).cwiseMax(min_length);
+	VectorX ub = 1.5 * lengths;
+
+	VectorX best_lengths = lengths;
+	VectorX best_x;
+	real best_energy = infinity;
+	int improvements = 0;
+	auto f = [&](const VectorX &l, VectorX &grad) -> real {
+		int j = 0;
+		for (auto &section : ruffle.sections) {
+			section.length = l(j++);
+		}
+		// starts from the previous equilibrium
+		ruffle.update_simulation_mesh();
+		ruffle.physics_solve();
+		forward_solves++;
+		real e = gradient(ruffle, grad);
+		if (e < best_energy) {
+			best_energy = e;
+			best_lengths = l;
+			best_x = ruffle.simulation_mesh.x;
+			improvements++;
+		}
+		return e;
+	};
+
+	LBFGSpp::LBFGSBSolver<real> solver(param);
+	real energy;
+	try {
+		solver.minimize(f, lengths, energy, lb, ub);
+	} catch (std::runtime_error &) {
+		// the line search gives up where the equilibrium jumps, the best
+		// lengths so far are kept below
+	}
+
+	// the last evaluation may have been a rejected line search step. Solving
+	// for the best lengths from there could settle on the other side of the
+	// jump, so start from the equilibrium found for them.
+	i = 0;
+	for (auto &section : ruffle.sections) {
+		section.length = best_lengths(i++);
+	}
+	ruffle.update_simulation_mesh();
+	if (best_x.size() == ruffle.simulation_mesh.x.size()) {
+		ruffle.simulation_mesh.x = best_x;
+	}
+	ruffle.physics_solve();
+	forward_solves++;
+	return improvements;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common/common.h"
+#include "ruffle/ruffle.h"
+#include "optimization/target_shape.h"
+
+#include <LBFGSB.h>
+
+namespace ruffles::optimization {
+
+/// Optimizes the section lengths of a ruffle for a TargetShape with
+/// L-BFGS-B. The gradient of the target energy with respect to all lengths
+/// comes from a single adjoint solve with the Hessian at the equilibrium,
+/// instead of one forward solve per section.
+class Adjoint {
+public:
+	TargetShape target;
+	real min_length = 0.1;
+	LBFGSpp::LBFGSBParam<real> param;
+
+	// physics solves run by optimize so far
+	int forward_solves = 0;
+
+	Adjoint();
+	Adjoint(TargetShape target);
+
+	/// TargetShape::energy of ruffle and its gradient with respect to the
+	/// section lengths, in the order of ruffle.sections. Assumes the mesh is
+	/// at equilibrium for the current lengths.
+	real gradient(Ruffle &ruffle, VectorX &grad);
+
+	/// Runs L-BFGS-B over the section lengths, within half and one and a
+	/// half times the current lengths and above min_length, and leaves ruffle
+	/// solved for the best lengths found. Returns how often an evaluation
+	/// improved on the best lengths so far, L-BFGS-B doesn't report its
+	/// iterations when the line search gives up.
+	int optimize(Ruffle &ruffle);
+};
+
+}
@@ -5,6 +5,54 @@
 
 namespace ruffles::optimization {
 
+// smallest signed distance to the target over the vertices of each outline
+// section, infinity for the other sections, in the order of ruffle.sections
+static vector<real> outline_distances(TargetShape &target, Ruffle &ruffle) {
+	int n = 0;
+	for (auto &section : ruffle.sections) {
+		if (section.type == Ruffle::Section::Type::Outline) {
+			n += section.mesh_segments.size();
+		}
+	}
+	Matrix<real, 2, -1> pos(2, n);
+	int i = 0;
+	for (auto &section : ruffle.sections) {
+		if (section.type == Ruffle::Section::Type::Outline) {
+			for (auto &seg : section.mesh_segments) {
+				pos.col(i++) = ruffle.simulation_mesh.get_vertex_position(*seg->start);
+			}
+		}
+	}
+	VectorX dist = target.signed_distances(pos);
+
+	vector<real> res;
+	res.reserve(ruffle.sections.size());
+	i = 0;
+	for (auto &section : ruffle.sections) {
+		real closest_distance = infinity;
+		if (section.type == Ruffle::Section::Type::Outline) {
+			for (size_t k = 0; k < section.mesh_segments.size(); k++) {
+				closest_distance = min(closest_distance, dist(i++));
+			}
+		}
+		res.push_back(closest_distance);
+	}
+	return res;
+}
+
+// signed distances to the target of the start and end of each interior
+// section, as columns in the order of ruffle.sections
+static Matrix<real, 2, -1> interior_distances(TargetShape &target, Ruffle &ruffle) {
+	Matrix<real, 2, -1> pos(2, 2*ruffle.sections.size());
+	int i = 0;
+	for (auto &section : ruffle.sections) {
+		pos.col(i++) = ruffle.simulation_mesh.get_vertex_position(*section.start->mesh_vertex);
+		pos.col(i++) = ruffle.simulation_mesh.get_vertex_position(*section.end->mesh_vertex);
+	}
+	VectorX dist = target.signed_distances(pos);
+	return Eigen::Map<Matrix<real, 2, -1>>(dist.data(), 2, ruffle.sections.size());
+}
+
 Heuristic::Heuristic() {
 	
 }
@@ -13,21 +61,12 @@ Heuristic::Heuristic(TargetShape target)
 }
 
 void Heuristic::step(Ruffle &ruffle) {
-	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section) {
+	vector<real> distances = outline_distances(target, ruffle);
+	int i = 0;
+	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section, ++i) {
 		if (section->type != Ruffle::Section::Type::Outline)
 			continue;
-		real closest_distance = infinity;
-		for (auto &seg : section->mesh_segments) {
-			auto vertex = seg->start;
-			Vector2 pos = ruffle.simulation_mesh.get_vertex_position(*vertex);
-			
-			//real x = target.intersect_horizontal(pos(1))[(i & 2) ? 0 : 1];
-			closest_distance = min(closest_distance, target.signed_distance(pos));
-			/*if (std::isfinite(x)) {
-				closest_distance = min(closest_distance,
-					(i & 2) ? (pos(0) - x) : (x - pos(0)));
-			}*/
-		}
+		real closest_distance = distances[i];
 		dbg(closest_distance);
 
 		if (std::isfinite(closest_distance)) {
@@ -35,11 +74,13 @@ void Heuristic::step(Ruffle &ruffle) {
 		}
 	}
 
-	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section) {
+	Matrix<real, 2, -1> end_distances = interior_distances(target, ruffle);
+	int j = 0;
+	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section, ++j) {
 		if (section->type != Ruffle::Section::Type::Interior)
 			continue;
-		real dist_a = target.signed_distance(ruffle.simulation_mesh.get_vertex_position(*section->start->mesh_vertex));
-		real dist_b = target.signed_distance(ruffle.simulation_mesh.get_vertex_position(*section->end->mesh_vertex));
+		real dist_a = end_distances(0, j);
+		real dist_b = end_distances(1, j);
 
 		// we have:          l ~= alpha * (l + dist_a + dist_b)
 		//          (1-alpha)l ~= dist_a + dist_b
@@ -59,11 +100,13 @@ void Heuristic::step(Ruffle &ruffle) {
 
 
 void Heuristic::step_inner(Ruffle &ruffle) {
-	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section) {
+	Matrix<real, 2, -1> end_distances = interior_distances(target, ruffle);
+	int j = 0;
+	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section, ++j) {
 		if (section->type != Ruffle::Section::Type::Interior)
 			continue;
-		real dist_a = target.signed_distance(ruffle.simulation_mesh.get_vertex_position(*section->start->mesh_vertex));
-		real dist_b = target.signed_distance(ruffle.simulation_mesh.get_vertex_position(*section->end->mesh_vertex));
+		real dist_a = end_distances(0, j);
+		real dist_b = end_distances(1, j);
 
 		// we have:          l ~= alpha * (l + dist_a + dist_b)
 		//          (1-alpha)l ~= dist_a + dist_b
@@ -82,21 +125,12 @@ void Heuristic::step_inner(Ruffle &ruffle) {
 }
 
 void Heuristic::step_outer(Ruffle &ruffle) {
-	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section) {
+	vector<real> distances = outline_distances(target, ruffle);
+	int i = 0;
+	for (auto section = ruffle.sections.begin(); section != ruffle.sections.end(); ++section, ++i) {
 		if (section->type != Ruffle::Section::Type::Outline)
 			continue;
-		real closest_distance = infinity;
-		for (auto &seg : section->mesh_segments) {
-			auto vertex = seg->start;
-			Vector2 pos = ruffle.simulation_mesh.get_vertex_position(*vertex);
-			
-			//real x = target.intersect_horizontal(pos(1))[(i & 2) ? 0 : 1];
-			closest_distance = min(closest_distance, target.signed_distance(pos));
-			/*if (std::isfinite(x)) {
-				closest_distance = min(closest_distance,
-					(i & 2) ? (pos(0) - x) : (x - pos(0)));
-			}*/
-		}
+		real closest_distance = distances[i];
 		dbg(closest_distance);
 
 		if (std::isfinite(closest_distance)) {
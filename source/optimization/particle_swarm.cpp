@@ -3,11 +3,16 @@
 #include "simulation/verlet.h"
 #include "simulation/lbfgs.h"
 #include "simulation/combination.h"
+#include "simulation/ensemble.h"
+
+#include "common/thread_pool.h"
+
+#include <chrono>
 
 namespace ruffles::optimization {
 // implement particle
-ParticleSwarm::Particle::Particle(Ruffle &ruffle_)
-	: ruffle(ruffle_.clone()), best(ruffle_.sections.size()), best_value(infinity) {
+ParticleSwarm::Particle::Particle(Ruffle &ruffle_, unsigned long seed)
+	: ruffle(ruffle_.clone()), best(ruffle_.sections.size()), best_value(infinity), rng(seed) {
 	//ruffle.simulator.reset(new simulation::Verlet(ruffle.simulation_mesh));
 	//ruffle.simulator.reset(new simulation::LBFGS(ruffle.simulation_mesh));
 	ruffle.simulator.reset(new simulation::Combination(ruffle.simulation_mesh));
@@ -22,7 +27,7 @@ void ParticleSwarm::Particle::set_lengths() {
 	ruffle.update_simulation_mesh();
 }
 
-ParticleSwarm::ParticleSwarm(TargetShape target_shape, Ruffle &ruffle, int n)
+ParticleSwarm::ParticleSwarm(TargetShape target_shape, Ruffle &ruffle, int n, unsigned long seed)
 	: target_shape(target_shape), global_best_value(infinity), global_best_ruffle(nullptr) {
 	m = ruffle.sections.size();
 	VectorX x0(m);
@@ -36,10 +41,13 @@ ParticleSwarm::ParticleSwarm(TargetShape target_shape, Ruffle &ruffle, int n)
 	VectorX lb = 0.5 * x0;
 	VectorX ub = 1.5 * x0;
 
+	std::seed_seq seeds {seed};
+	vector<unsigned long> particle_seeds(n);
+	seeds.generate(particle_seeds.begin(), particle_seeds.end());
 	for (int i = 0; i < n; i++) {
-		particles.emplace_back(ruffle);
+		particles.emplace_back(ruffle, particle_seeds[i]);
 		Particle &particle = particles.back();
-		VectorX x = lb + random_vector(m).cwiseProduct(ub-lb);
+		VectorX x = lb + random_vector(m, particle.rng).cwiseProduct(ub-lb);
 		particle.x = x;
 		// ?
 		particle.v = VectorX::Zero(m);
@@ -68,22 +76,64 @@ void ParticleSwarm::update_best() {
 }
 
 void ParticleSwarm::physics_solve() {
-	int i = 0;
 	cerr << "Solving " << particles.size() << " ruffles!" << endl;
-	// TODO: parallelize
+	if (!batched) {
+		// the particles own their ruffle and simulator, and take between tens
+		// and thousands of steps
+		ThreadPool::global().parallel_tasks(particles.size(), [&](int i) {
+			particles[i].ruffle.physics_solve();
+		});
+		return;
+	}
+
+	// section lengths decide which segments get split, so not all particles
+	// share the same mesh
+	vector<vector<Ruffle *>> groups;
 	for (auto &particle : particles) {
-		particle.ruffle.physics_solve();
-		i++;
-		cerr << i << "/" << particles.size() << endl;
+		simulation::SimulationMesh &mesh = particle.ruffle.simulation_mesh;
+		mesh.invalidate_parameters();
+		mesh.relax_air_mesh();
+		auto group = std::find_if(groups.begin(), groups.end(), [&](auto &group) {
+			return simulation::Ensemble::same_topology(group.front()->simulation_mesh, mesh);
+		});
+		if (group == groups.end()) {
+			groups.emplace_back();
+			group = std::prev(groups.end());
+		}
+		group->push_back(&particle.ruffle);
 	}
+
+	// a single group keeps the thread pool for the ensemble's energy
+	int max_steps = particles.front().ruffle.solve_settings.max_steps;
+	ThreadPool::global().parallel_tasks(groups.size(), [&](int i) {
+		auto start = std::chrono::steady_clock::now();
+		vector<simulation::SimulationMesh *> meshes;
+		for (Ruffle *ruffle : groups[i]) {
+			meshes.push_back(&ruffle->simulation_mesh);
+		}
+		simulation::Ensemble ensemble(meshes);
+		int steps = ensemble.solve(max_steps);
+		real seconds = std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count();
+
+		// the members share steps and time, only stop and energy are their own
+		for (int j = 0; j < ensemble.size(); j++) {
+			Ruffle::SolveReport &report = groups[i][j]->last_solve_report;
+			report = Ruffle::SolveReport();
+			report.stop = ensemble.converged(j) ? Ruffle::SolveReport::Stop::Converged : Ruffle::SolveReport::Stop::StepLimit;
+			report.steps = steps;
+			report.energy = meshes[j]->energy(meshes[j]->x, nullptr);
+			report.total_time = seconds;
+			report.solver_time = seconds;
+		}
+	});
 }
 
 void ParticleSwarm::step() {
 	for (auto &particle : particles) {
 		particle.v =
 			omega*particle.v
-		      + phi_p*random_vector(m).cwiseProduct(particle.best-particle.x)
-		      + phi_g*random_vector(m).cwiseProduct(global_best  -particle.x);
+		      + phi_p*random_vector(m, particle.rng).cwiseProduct(particle.best-particle.x)
+		      + phi_g*random_vector(m, particle.rng).cwiseProduct(global_best  -particle.x);
 		particle.x += learning_rate * particle.v;
 		particle.set_lengths();
 	}
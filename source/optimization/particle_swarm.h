@@ -19,7 +19,11 @@ public:
 		VectorX best;
 		real best_value;
 
-		Particle(Ruffle &ruffle_);
+		// own generator, so the swarm is reproducible for a seed no matter
+		// in which order the particles are processed
+		std::mt19937_64 rng;
+
+		Particle(Ruffle &ruffle_, unsigned long seed);
 
 		void set_lengths();
 	};
@@ -39,11 +43,18 @@ public:
 
 	real learning_rate = 1.0;
 
+	// solve particles of equal topology together in a simulation::Ensemble
+	// instead of one Ruffle::physics_solve each. That skips multires and the
+	// solve_settings except max_steps, and was 1.5-2x slower on one core.
+	bool batched = false;
+
 
-	ParticleSwarm(TargetShape target_shape, Ruffle &ruffle, int n);
+	ParticleSwarm(TargetShape target_shape, Ruffle &ruffle, int n, unsigned long seed = 0);
 
 	void update_best();
 
+	/// Solves the particles (or ensembles, if batched) concurrently on the
+	/// global ThreadPool
 	void physics_solve();
 
 	void step();
@@ -1,5 +1,7 @@
 #include "optimization/target_shape.h"
 
+#include "common/thread_pool.h"
+
 #include <CGAL/Triangulation_vertex_base_with_info_2.h>
 #include <CGAL/Constrained_Delaunay_triangulation_2.h>
 
@@ -15,10 +17,9 @@ typedef CGAL::Constrained_Delaunay_triangulation_2<K,TriangulationDataStructure>
 
 
 using ruffles::K;
-typedef CGAL::Direction_2<K> Direction;
-typedef CGAL::Ray_2<K> Ray;
-typedef CGAL::Line_2<K> Line;
-typedef CGAL::Segment_2<K> Segment;
+
+// below this many points or rays a batch query isn't worth waking the thread pool
+static const int min_parallel_queries = 4096;
 
 TargetShape::TargetShape() {}
 
@@ -65,6 +66,7 @@ TargetShape::TargetShape(Polygon target) : target(target) {
 			faces[i][2];
 	}
 
+	update_target_cache();
 }
 
 TargetShape::TargetShape(Eigen::MatrixXd &cut_shape, Vector3 origin, Vector3 u_dir, Vector3 v_dir) : origin(origin), u_dir(u_dir), v_dir(v_dir), V(cut_shape) {
@@ -80,15 +82,35 @@ TargetShape::TargetShape(Eigen::MatrixXd &cut_shape, Vector3 origin, Vector3 u_d
 		real v = x.dot(v_dir) - ov;
 		target.push_back(Point(u,v));
 	}
+	update_target_cache();
+}
+
+void TargetShape::update_target_cache() {
+	PolygonIntersection::Points points(2, target.size());
+	for (unsigned i = 0; i < target.size(); i++) {
+		points.col(i) <<
+			CGAL::to_real(target.vertex(i).x()),
+			CGAL::to_real(target.vertex(i).y());
+	}
+	target_intersection = PolygonIntersection(points);
+	target_edges = EdgeBVH(points);
+	target_area = CGAL::to_real(target.area());
 }
 
-real TargetShape::energy(Ruffle &ruffle) {
-	Polygon outline;
-	for (auto outline_section : ruffle.outline_sections) {
+real TargetShape::energy(Ruffle &ruffle, VectorX *grad) {
+	int n = 0;
+	for (auto &outline_section : ruffle.outline_sections) {
+		n += outline_section.section->mesh_segments.size();
+	}
+	PolygonIntersection::Points outline(2, n);
+	vector<int> outline_index(n); // into x, -1 for fixed vertices
+	int i = 0;
+	for (auto &outline_section : ruffle.outline_sections) {
 		auto &segments = outline_section.section->mesh_segments;
 		auto push_vertex = [&](simulation::SimulationMesh::Vertex &v) {
-			Vector2 x = ruffle.simulation_mesh.get_vertex_position(v);
-			outline.push_back(Point(x(0), x(1)));
+			const int *ix = std::get_if<int>(&v);
+			outline_index[i] = ix ? *ix : -1;
+			outline.col(i++) = ruffle.simulation_mesh.get_vertex_position(v);
 		};
 		if (outline_section.reversed) {
 			for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
@@ -101,43 +123,43 @@ real TargetShape::energy(Ruffle &ruffle) {
 		}
 	}
 
-	real outline_area = CGAL::to_real(outline.area());
-	// cache?
-	real target_area =  CGAL::to_real(target.area());
+	PolygonIntersection::Points outline_grad, intersection_grad;
+	real outline_area = polygon_area(outline, grad ? &outline_grad : nullptr);
 
-	vector<PolygonWithHoles> intersection;
-	CGAL::intersection(target, outline, std::back_inserter(intersection));
-	real intersection_area = 0.;
-	for (auto its : intersection) {
-		intersection_area += CGAL::to_real(its.outer_boundary().area());
+	std::optional<real> intersection_area = target_intersection.intersection_area(outline, grad ? &intersection_grad : nullptr);
+	bool degenerate = !intersection_area;
+	if (degenerate) {
+		// touching in a way double precision can't decide, do it exactly
+		Polygon exact_outline;
+		for (int j = 0; j < n; j++) {
+			exact_outline.push_back(Point(outline(0,j), outline(1,j)));
+		}
+		vector<PolygonWithHoles> intersection;
+		CGAL::intersection(target, exact_outline, std::back_inserter(intersection));
+		intersection_area = 0.;
+		for (auto its : intersection) {
+			*intersection_area += CGAL::to_real(its.outer_boundary().area());
+		}
 	}
 
-	return k*(target_area-intersection_area) + lambda*(outline_area-intersection_area);
-}
-
-array<real,2> TargetShape::intersect_horizontal(real height) {
-	Line line(0,1,-height);
-
-	// appearently we have to implement every little thing ourselves :/
-	real x_min = infinity;
-	real x_max = -infinity;
-	for (auto it = target.edges_begin(); it != target.edges_end(); ++it) {
-		auto its = CGAL::intersection(line, *it);
-		if (its) {
-			if (Segment* seg = boost::get<Segment>(&*its)) {
-				real x0 = CGAL::to_real(seg->vertex(0).x());
-				real x1 = CGAL::to_real(seg->vertex(1).x());
-				x_min = min(x_min, min(x0,x1));
-				x_max = max(x_max, max(x0,x1));
-			}
-			if (Point* point = boost::get<Point>(&*its)) {
-				x_min = min(x_min, CGAL::to_real(point->x()));
-				x_max = max(x_max, CGAL::to_real(point->x()));
+	if (grad) {
+		grad->setZero(ruffle.simulation_mesh.dof());
+	}
+	if (grad && !degenerate) {
+		// only the outline moves
+		PolygonIntersection::Points g = lambda*outline_grad - (k+lambda)*intersection_grad;
+		for (int j = 0; j < n; j++) {
+			if (outline_index[j] >= 0) {
+				grad->segment<2>(2*outline_index[j]) += g.col(j);
 			}
 		}
 	}
 
-	return {x_min, x_max};
+	return k*(target_area-*intersection_area) + lambda*(outline_area-*intersection_area);
+}
+
+array<real,2> TargetShape::intersect_horizontal(real height) {
+	return target_edges.intersect_horizontal(height);
 }
 
 real TargetShape::height() {
@@ -157,38 +179,44 @@ real TargetShape::avg_width() {
 }
 
 real TargetShape::signed_distance(Vector2 pos) {
-	real min_dist = infinity;
-	Point point(pos.x(), pos.y());
-	for (auto it = target.edges_begin(); it != target.edges_end(); ++it) {
-		auto dist2 = CGAL::squared_distance(point, *it);
-		real dist = sqrt(CGAL::to_real(dist2));
+	return target_edges.signed_distance(pos);
+}
 
-		min_dist = min(min_dist, dist);
-	}
-	if (target.has_on_unbounded_side(point)) {
-		min_dist *= -1;
+VectorX TargetShape::signed_distances(const Matrix<real, 2, -1> &pos) {
+	VectorX res(pos.cols());
+	auto run = [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			res(i) = target_edges.signed_distance(pos.col(i));
+		}
+	};
+	ThreadPool &pool = ThreadPool::global();
+	if (pos.cols() >= min_parallel_queries && pool.size() > 1) {
+		pool.parallel_for(pos.cols(), run);
+	} else {
+		run(0, 0, pos.cols());
 	}
-	return min_dist;
+	return res;
 }
 
 real TargetShape::raycast(Vector2 ro, Vector2 rd) {
-	real t = infinity;
-
-	Point source(ro.x(), ro.y());
-	Ray ray(source, Direction(rd.x(), rd.y()));
-	for (auto it = target.edges_begin(); it != target.edges_end(); ++it) {
-		auto its = CGAL::intersection(ray, *it);
-		if (its) {
-			if (Segment* seg = boost::get<Segment>(&*its)) {
-				t = min(t, sqrt(CGAL::to_real(CGAL::squared_distance(source, seg->vertex(0)))));
-				t = min(t, sqrt(CGAL::to_real(CGAL::squared_distance(source, seg->vertex(1)))));
-			}
-			if (Point* point = boost::get<Point>(&*its)) {
-				t = min(t, sqrt(CGAL::to_real(CGAL::squared_distance(source, *point))));
-			}
+	return target_edges.raycast(ro, rd);
+}
+
+VectorX TargetShape::raycasts(const Matrix<real, 2, -1> &ro, const Matrix<real, 2, -1> &rd) {
+	assert(ro.cols() == rd.cols());
+	VectorX res(ro.cols());
+	auto run = [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			res(i) = target_edges.raycast(ro.col(i), rd.col(i));
 		}
+	};
+	ThreadPool &pool = ThreadPool::global();
+	if (ro.cols() >= min_parallel_queries && pool.size() > 1) {
+		pool.parallel_for(ro.cols(), run);
+	} else {
+		run(0, 0, ro.cols());
 	}
-	return t;
+	return res;
 }
 
 }
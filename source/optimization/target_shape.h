@@ -2,6 +2,8 @@
 
 #include "common/common.h"
 #include "common/cgal_util.h"
+#include "common/edge_bvh.h"
+#include "common/polygon_intersection.h"
 
 namespace ruffles::optimization {
 	class TargetShape;
@@ -32,10 +34,27 @@ public:
 	real height();
 	real avg_width();
 
-	real energy(Ruffle &ruffle);
+	/// Area of the target not covered by the outline of ruffle plus area of
+	/// the outline outside the target, weighted by k and lambda. With grad,
+	/// also its gradient with respect to ruffle.simulation_mesh.x, which is
+	/// zero where the outline touches the target in a way double precision
+	/// can't classify.
+	real energy(Ruffle &ruffle, VectorX *grad = nullptr);
 	array<real,2> intersect_horizontal(real height);
 	real signed_distance(Vector2 pos);
+	// signed_distance() of every column
+	VectorX signed_distances(const Matrix<real, 2, -1> &pos);
 	real raycast(Vector2 ro, Vector2 rd);
+	// raycast() for every column of ro and rd
+	VectorX raycasts(const Matrix<real, 2, -1> &ro, const Matrix<real, 2, -1> &rd);
+
+private:
+	void update_target_cache();
+
+	// target in double precision, for energy() and the geometric queries
+	PolygonIntersection target_intersection;
+	EdgeBVH target_edges;
+	real target_area = 0.;
 };
 
 }
@@ -2,8 +2,6 @@
 
 #include <sstream>
 
-#include "common/clone_helper.h"
-
 
 namespace ruffles {
 
@@ -44,7 +42,7 @@ unique_ptr<XMLDocument> create_svg(Ruffle &ruffle) {
         points_lower.emplace_back(l, z1);
     };
 
-    std::unordered_map<listref<Ruffle::ConnectionPoint>,int,listref_hash<Ruffle::ConnectionPoint>> seen;
+    vector<int> seen(ruffle.connection_points.capacity(), 0); // label, 0 if not seen yet
     int last = 0;
     auto add_connection = [&](auto cp) {
         if (cp->connecting_segments[0].size() + cp->connecting_segments[1].size() <= 2) {
@@ -61,13 +59,13 @@ unique_ptr<XMLDocument> create_svg(Ruffle &ruffle) {
         
         bool which;
         int label;
-        if (auto it = seen.find(cp); it != seen.end()) {
-            label = it->second;
+        if (seen[cp.index()]) {
+            label = seen[cp.index()];
             which = false;
         } else {
             which = true;
             label = ++last;
-            seen.emplace(cp, label);
+            seen[cp.index()] = label;
         }
 
         auto connector = doc->NewElement(which ? "path" : "polyline");
@@ -1,8 +1,14 @@
 #include "ruffle/ruffle.h"
 
-#include <unordered_set>
+#include "simulation/coarse_mesh.h"
+#include "simulation/newton.h"
 
+
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
 
 namespace ruffles {
 
@@ -16,8 +22,17 @@ using Section = Ruffle::Section;
 Ruffle::Ruffle() {}
 
 void Ruffle::update_simulation_mesh() {
-	// update the length of each segment
+	// after changes to the topology, the masses and connection bends can't
+	// be patched section by section
+	bool full = simulation_mesh.topology_version != updated_topology_version;
+	bool split = false;
+
+	// update the length of each changed segment
 	for (auto &section : sections) {
+		if (!full && section.length == section.mesh_length) {
+			continue;
+		}
+		section.mesh_length = section.length;
 		real segment_length = section.length / section.mesh_segments.size();
 
 		for (auto segment : section.mesh_segments) {
@@ -40,26 +55,68 @@ void Ruffle::update_simulation_mesh() {
 			listref<SimulationMesh::Segment> new_first = section.mesh_segments.front();
 			listref<SimulationMesh::Segment> new_last  = section.mesh_segments.back();
 
+			// the old segments are gone, but their slots are not reused by
+			// anything the references below can see yet
+			auto replace = [&](listref<SimulationMesh::Segment> &it) {
+				if (it == old_first) {
+					it = new_first;
+				}
+				if (it == old_last) {
+					it = new_last;
+				}
+			};
 			for (auto &vx : {section.start, section.end}) {
 				for (int side = 0; side < 2; ++side) {
 					for (auto &it : vx->connecting_segments[side]) {
-						if (it == old_first) {
-							it = new_first;
-						}
-						if (it == old_last) {
-							it = new_last;
-						}
+						replace(it);
 					}
 				}
 			}
+			for (auto &bend : simulation_mesh.connection_bends) {
+				replace(bend[0]);
+				replace(bend[1]);
+			}
+			split = true;
+
+			if (0.5*segment_length > 2*h) {
+				// split again on the next update
+				section.mesh_length = -1.;
+			}
+		}
 
-			simulation_mesh.relax_air_mesh();
-			create_connection_bends();
+		if (!full) {
+			update_section_mass(section);
 		}
-		
 	}
 
-	simulation_mesh.update_vertex_mass();
+	if (split) {
+		simulation_mesh.relax_air_mesh();
+	}
+	if (full) {
+		simulation_mesh.update_vertex_mass();
+	} else {
+		simulation_mesh.invalidate_parameters();
+	}
+	updated_topology_version = simulation_mesh.topology_version;
+}
+
+void Ruffle::update_section_mass(Section &section) {
+	auto &segments = section.mesh_segments;
+	for (size_t i = 0; i+1 < segments.size(); i++) {
+		assert(segments[i]->end == segments[i+1]->start);
+		real mass = simulation_mesh.segment_mass(*segments[i])[1] + simulation_mesh.segment_mass(*segments[i+1])[0];
+		simulation_mesh.set_vertex_mass(*segments[i]->end, mass);
+	}
+	// the connection points also get mass from the neighbouring sections
+	for (auto &point : {section.start, section.end}) {
+		real mass = 0.;
+		for (int side = 0; side < 2; side++) {
+			for (auto seg : point->connecting_segments[side]) {
+				mass += simulation_mesh.segment_mass(*seg)[seg->start == point->mesh_vertex ? 0 : 1];
+			}
+		}
+		simulation_mesh.set_vertex_mass(*point->mesh_vertex, mass);
+	}
 }
 
 
@@ -207,6 +264,7 @@ void Ruffle::create_connection_bends() {
 		i++;
 		}
 	}
+	simulation_mesh.invalidate_topology();
 }
 
 listref<Section> Ruffle::subdivide(listref<Section> section) {
@@ -481,15 +539,15 @@ listref<Section> Ruffle::densify3(listref<Section> section) {
 	simulation_mesh.air_mesh.clear();
 
 
-	std::unordered_set<listref<ConnectionPoint>, listref_hash<ConnectionPoint>> visited_vertices;
+	vector<bool> visited_vertices(connection_points.capacity(), false);
 	for (auto it = std::next(section); it != sections.end(); ++it) {
-		visited_vertices.emplace(it->end);
+		visited_vertices[it->end.index()] = true;
 	}
 	listref<ConnectionPoint> apex;
 	int apex_count = 0;
 	for (auto it = section; it != sections.begin(); ) {
 		--it;
-		if (visited_vertices.count(it->start)) {
+		if (visited_vertices[it->start.index()]) {
 			apex_count++;
 			apex = it->start;
 		}
@@ -821,6 +879,44 @@ Ruffle Ruffle::create_horizontal_stack(int steps, real height, real width, real
 	return res;
 }
 
+namespace {
+
+// Points of the polyline at the increasing arc lengths samples, and the unit
+// normals pointing to the right there. The last sample may overshoot the end
+// a little.
+void sample_curve(const MatrixX &points, const vector<real> &samples, Matrix<real, 2, -1> &positions, Matrix<real, 2, -1> &normals) {
+	int n = points.rows();
+	positions.resize(2, samples.size());
+	normals.resize(2, samples.size());
+	int segment = 0;
+	real segment_start = 0.;
+	for (size_t i = 0; i < samples.size(); i++) {
+		real t = samples[i];
+		real segment_length = (points.row(segment+1)-points.row(segment)).norm();
+		while (t - segment_start > segment_length) {
+			segment++;
+			if (segment >= n-1) {
+				assert(i == samples.size() - 1);
+				dbg(t-segment_start);
+				dbg(segment_length);
+				segment--;
+				break;
+			}
+			segment_start += segment_length;
+			segment_length = (points.row(segment+1)-points.row(segment)).norm();
+		}
+
+		real alpha = (t - segment_start) / segment_length;
+		Vector2 xy = (points.row(segment+1)*alpha + points.row(segment)*(1-alpha)).transpose();
+		dbg(xy);
+		Vector2 tangent = (points.row(segment+1)-points.row(segment)).transpose() / segment_length;
+		positions.col(i) = xy;
+		normals.col(i) = Vector2(tangent.y(), -tangent.x());
+	}
+}
+
+}
+
 Ruffle Ruffle::create_stack_along_curve(MatrixX points, optimization::TargetShape &target, real h) {
 	Ruffle res;
 	res.h = h;
@@ -882,35 +978,24 @@ Ruffle Ruffle::create_stack_along_curve(MatrixX points, optimization::TargetShap
 		t *= scale_factor;
 	}
 
-	int segment = 0;
-	real segment_start = 0.;
+	// sample positions and normals, then the rays to both sides in one batch:
+	// columns [0, m) to the right and [m, 2m) to the left
+	int m = samples.size();
+	Matrix<real, 2, -1> positions, normals;
+	sample_curve(points, samples, positions, normals);
+	Matrix<real, 2, -1> ray_origins(2, 2*m), ray_dirs(2, 2*m);
+	ray_origins << positions, positions;
+	ray_dirs << normals, -normals;
+	// TODO: raycast at angle?
+	VectorX ray_dists = target.raycasts(ray_origins, ray_dirs);
 
 	listref<ConnectionPoint> left, right;
 	Vector2 prev_normal;
-	for (int i = 0; i < samples.size(); i++) {
-		real t = samples[i];
-		real segment_length = (points.row(segment+1)-points.row(segment)).norm();
-		while (t - segment_start > segment_length) {
-			segment++;
-			if (segment >= n-1) {
-				assert(i == samples.size() - 1);
-				dbg(t-segment_start);
-				dbg(segment_length);
-				segment--;
-				break;
-			}
-			segment_start += segment_length;
-			segment_length = (points.row(segment+1)-points.row(segment)).norm();
-		}
-
-		real alpha = (t - segment_start) / segment_length;
-		Vector2 xy = (points.row(segment+1)*alpha + points.row(segment)*(1-alpha)).transpose();
-		dbg(xy);
-		Vector2 tangent = (points.row(segment+1)-points.row(segment)).transpose() / segment_length;
-		Vector2 normal(tangent.y(), -tangent.x()); // pointing to the right
-		// TODO: raycast at angle?
-		real right_dist = target.raycast(xy, normal);
-		real left_dist = target.raycast(xy, -normal);
+	for (int i = 0; i < m; i++) {
+		Vector2 xy = ray_origins.col(i);
+		Vector2 normal = ray_dirs.col(i);
+		real right_dist = ray_dists(i);
+		real left_dist = ray_dists(m+i);
 
 		bool fixed = i == 0 || i == samples.size()-1;
 		auto nleft  = res.push_connection_point(xy - inner_width_ratio*left_dist*normal, fixed);
@@ -979,7 +1064,10 @@ void Ruffle::verify() {
 		assert(it->end->mesh_vertex == it->mesh_segments.back()->end);
 	}
 
-	// outline must be a closed loop
+	// outline must be a closed loop, if there is one
+	if (outline_sections.empty()) {
+		return;
+	}
 	listref<ConnectionPoint> prev = outline_sections.back().end();
 	for (auto it = outline_sections.begin(); it != outline_sections.end(); ++it) {
 		assert(it->start() == prev);
@@ -988,39 +1076,574 @@ void Ruffle::verify() {
 }
 
 
-void Ruffle::physics_solve() {
+Ruffle Ruffle::clone() const {
+	Ruffle res;
+	res.simulation_mesh = simulation_mesh.clone();
+	if (simulator) {
+		res.simulator = simulator->clone();
+	}
+
+	// copies of the lists, still referring to our elements
+	res.connection_points = connection_points;
+	res.sections = sections;
+	res.outline_sections = outline_sections;
+
+	Translate<Vertex> vertex(res.simulation_mesh.vertices);
+	Translate<Segment> segment(res.simulation_mesh.segments);
+	Translate<ConnectionPoint> point(res.connection_points);
+	Translate<Section> section(res.sections);
+	for (auto &p : res.connection_points) {
+		vertex.remap(p.mesh_vertex);
+		for (int side = 0; side < 2; side++) {
+			segment.remap(p.connecting_segments[side]);
+		}
+	}
+	for (auto &sec : res.sections) {
+		point.remap(sec.start);
+		point.remap(sec.end);
+		segment.remap(sec.mesh_segments);
+	}
+	for (auto &outline : res.outline_sections) {
+		section.remap(outline.section);
+	}
+
+	res.h = h;
+	res.solve_settings = solve_settings;
+	res.last_solve_report = last_solve_report;
+	res.multires_levels = multires_levels;
+	res.multires_factor = multires_factor;
+	res.last_physics_solve_time = last_physics_solve_time;
+	res.physics_solve_total_time = physics_solve_total_time;
+	res.physics_solve_count = physics_solve_count;
+	return res;
+}
+
+
+void Ruffle::multires_solve() {
+	using simulation::CoarseMesh;
+
+	vector<CoarseMesh::Chain> chains;
+	for (auto &section : sections) {
+		chains.push_back(section.mesh_segments);
+	}
+
+	vector<unique_ptr<CoarseMesh>> levels;
+	SimulationMesh *finer = &simulation_mesh;
+	for (int level = 0; level < multires_levels; level++) {
+		auto coarse = std::make_unique<CoarseMesh>(*finer, levels.empty() ? chains : levels.back()->chains, multires_factor);
+		if (!coarse->valid || coarse->mesh.segments.size() > 0.75 * finer->segments.size()) {
+			// merging would tangle the strip or barely saves anything
+			break;
+		}
+		finer = &coarse->mesh;
+		levels.push_back(std::move(coarse));
+	}
+
+	// the coarse levels only provide an initial guess, a rough solve is enough
+	for (int level = (int)levels.size()-1; level >= 0; level--) {
+		SimulationMesh &coarse = levels[level]->mesh;
+		simulation::Newton newton(coarse);
+		newton.epsilon = 1e-3;
+		for (int steps = 0; steps < 200 && !newton.step(coarse); steps++) {
+		}
+
+		SimulationMesh &fine = level > 0 ? levels[level-1]->mesh : simulation_mesh;
+		VectorX old_x = fine.x;
+		levels[level]->prolongate(fine);
+		if (!fine.air_mesh.empty() && fine.air_mesh.penalty(1., fine.x, nullptr) > 0.) {
+			// the coarse solution inverts the finer air mesh, don't use it
+			fine.x = old_x;
+		}
+	}
+}
+
+Ruffle::SolveReport Ruffle::physics_solve() {
+	using clock = std::chrono::steady_clock;
+	auto seconds_since = [](clock::time_point t) {
+		return std::chrono::duration_cast<std::chrono::duration<real>>(clock::now() - t).count();
+	};
+
+	SolveReport report;
 	if (simulator == nullptr) {
 		cerr << "No simulator set!" << endl;
-		return;
+		return report;
 	}
 
-	auto start = std::chrono::steady_clock::now();
+	auto start = clock::now();
+	SimulationMesh &mesh = simulation_mesh;
+	mesh.statistics = SimulationMesh::Statistics();
 
-	simulator->reset(simulation_mesh);
-	simulation_mesh.relax_air_mesh();
+	auto projected_gradient_norm = [&](const VectorX &grad) {
+		VectorX lb = mesh.lb.replicate(mesh.dof()/2, 1);
+		VectorX ub = mesh.ub.replicate(mesh.dof()/2, 1);
+		return (mesh.x - (mesh.x - grad).cwiseMax(lb).cwiseMin(ub)).norm();
+	};
 
-	int steps = 1;
-	for(; steps < 1000 && !simulator->step(simulation_mesh); steps++) {
-		//simulation_mesh.relax_air_mesh();
+	// widths and extra masses may have been edited since the last solve
+	mesh.invalidate_parameters();
+	if (multires_levels > 0) {
+		auto coarse_start = clock::now();
+		multires_solve();
+		report.coarse_time = seconds_since(coarse_start);
 	}
+	simulator->reset(mesh);
+	mesh.relax_air_mesh();
+
+	const SolveSettings &settings = solve_settings;
+	bool check_energy = settings.gradient_tolerance > 0. || settings.energy_tolerance > 0.;
+	real previous_energy = infinity;
+	report.stop = SolveReport::Stop::StepLimit;
+	for (report.steps = 1; report.steps <= settings.max_steps; report.steps++) {
+		if (simulator->step(mesh)) {
+			report.stop = SolveReport::Stop::Converged;
+			break;
+		}
+		if (check_energy) {
+			// the stopping tests aren't part of the solve statistics
+			SimulationMesh::Statistics solver_statistics = mesh.statistics;
+			VectorX grad = VectorX::Zero(mesh.dof());
+			real energy = mesh.energy(mesh.x, &grad);
+			mesh.statistics = solver_statistics;
+			if (settings.gradient_tolerance > 0. && projected_gradient_norm(grad) <= settings.gradient_tolerance) {
+				report.stop = SolveReport::Stop::Gradient;
+				break;
+			}
+			if (settings.energy_tolerance > 0. && energy > previous_energy) {
+				report.stop = SolveReport::Stop::EnergyIncrease;
+				break;
+			}
+			if (settings.energy_tolerance > 0. && previous_energy - energy <= settings.energy_tolerance * max(1., std::abs(energy))) {
+				report.stop = SolveReport::Stop::Energy;
+				break;
+			}
+			previous_energy = energy;
+		}
+		if (seconds_since(start) > settings.max_time) {
+			report.stop = SolveReport::Stop::TimeLimit;
+			break;
+		}
+	}
+	report.steps = std::min(report.steps, settings.max_steps);
+
+	report.total_time = seconds_since(start);
+	const SimulationMesh::Statistics &stats = mesh.statistics;
+	report.energy_evaluations = stats.energy_evaluations;
+	report.gradient_evaluations = stats.gradient_evaluations;
+	report.relax_calls = stats.relax_calls;
+	report.relax_flips = stats.relax_flips;
+	report.energy_time = stats.energy_time;
+	report.relax_time = stats.relax_time;
+	report.line_search_time = stats.line_search_time;
+	report.solver_time = max(0., report.total_time - report.energy_time - report.relax_time - report.coarse_time);
+
+	// not part of the solve statistics
+	VectorX grad = VectorX::Zero(mesh.dof());
+	report.energy = mesh.energy(mesh.x, &grad);
+	report.gradient_norm = projected_gradient_norm(grad);
+
+	// in one piece, ruffles may be solved concurrently
+	std::ostringstream line;
+	line << report << '\n';
+	cerr << line.str() << std::flush;
+
+	last_physics_solve_time = report.total_time;
+	physics_solve_total_time += report.total_time;
+	physics_solve_count += 1;
+	last_solve_report = report;
+	return report;
+}
 
-	cerr << "Converged? in " << steps << " steps" << endl;
+const char *Ruffle::SolveReport::stop_name() const {
+	switch (stop) {
+		case Stop::NoSimulator: return "no simulator";
+		case Stop::Converged: return "converged";
+		case Stop::Gradient: return "gradient tolerance";
+		case Stop::Energy: return "energy tolerance";
+		case Stop::EnergyIncrease: return "energy increase";
+		case Stop::StepLimit: return "step limit";
+		case Stop::TimeLimit: return "time limit";
+	}
+	return "";
+}
 
-	auto end = std::chrono::steady_clock::now();
-	real elapsed = std::chrono::duration_cast<std::chrono::duration<real>>(end-start).count();
 
-	last_physics_solve_time = elapsed;
-	physics_solve_total_time += elapsed;
-	physics_solve_count += 1;
+namespace {
+
+// Binary format of Ruffle::Serialize: plain little endian values, sizes and
+// references as int32. References are ordinals in the order of the lists.
+constexpr char serialization_magic[4] = {'R', 'F', 'L', 'B'};
+constexpr int32_t serialization_version = 1;
+
+bool host_is_little_endian() {
+	const uint16_t one = 1;
+	char first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
 }
 
+class Writer {
+public:
+	Writer(std::vector<char> &buffer) : buffer(buffer) {}
+
+	template<typename T>
+	void operator()(T value) {
+		static_assert(std::is_arithmetic_v<T>);
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		if (!host_is_little_endian()) {
+			std::reverse(bytes, bytes+sizeof(T));
+		}
+		buffer.insert(buffer.end(), bytes, bytes+sizeof(T));
+	}
+	void operator()(const Vector2 &v) {
+		(*this)(v(0));
+		(*this)(v(1));
+	}
+	void operator()(const VectorX &v) {
+		size(v.size());
+		for (real value : v) {
+			(*this)(value);
+		}
+	}
+	void size(size_t n) {
+		(*this)(int32_t(n));
+	}
+
+private:
+	std::vector<char> &buffer;
+};
+
+class Reader {
+public:
+	Reader(const std::vector<char> &buffer) : buffer(buffer) {}
+
+	template<typename T>
+	T read() {
+		static_assert(std::is_arithmetic_v<T>);
+		char little_endian[sizeof(T)];
+		std::memcpy(little_endian, bytes(sizeof(T)), sizeof(T));
+		if (!host_is_little_endian()) {
+			std::reverse(little_endian, little_endian+sizeof(T));
+		}
+		T value;
+		std::memcpy(&value, little_endian, sizeof(T));
+		return value;
+	}
+	Vector2 vector2() {
+		real x = read<real>();
+		return Vector2(x, read<real>());
+	}
+	VectorX vectorx() {
+		VectorX res(size());
+		for (real &value : res) {
+			value = read<real>();
+		}
+		return res;
+	}
+	int size() {
+		int32_t n = read<int32_t>();
+		// every element takes at least one byte
+		if (n < 0 || size_t(n) > buffer.size() - pos) {
+			throw std::runtime_error("Corrupt ruffle data: invalid size");
+		}
+		return n;
+	}
+	// a reference into a list of n elements
+	int index(int n) {
+		int32_t i = read<int32_t>();
+		if (i < 0 || i >= n) {
+			throw std::runtime_error("Corrupt ruffle data: reference out of range");
+		}
+		return i;
+	}
+	bool at_end() const {
+		return pos == buffer.size();
+	}
+
+private:
+	const char *bytes(size_t n) {
+		if (buffer.size() - pos < n) {
+			throw std::runtime_error("Corrupt ruffle data: unexpected end");
+		}
+		const char *res = buffer.data() + pos;
+		pos += n;
+		return res;
+	}
+
+	const std::vector<char> &buffer;
+	size_t pos = 0;
+};
+
+}
 
 void Ruffle::Serialize(std::vector<char> &buffer) const {
+	buffer.clear();
+	Writer write(buffer);
+	for (char c : serialization_magic) {
+		write(c);
+	}
+	write(serialization_version);
+
+	write(h);
+	write(int32_t(multires_levels));
+	write(int32_t(multires_factor));
+	write(int32_t(solve_settings.max_steps));
+	write(solve_settings.gradient_tolerance);
+	write(solve_settings.energy_tolerance);
+	write(solve_settings.max_time);
+
+	const SimulationMesh &mesh = simulation_mesh;
+	write(mesh.k_global);
+	write(mesh.k_bend);
+	write(mesh.density);
+	write(mesh.lambda_membrane);
+	write(mesh.lambda_air_mesh);
+	write(uint8_t(mesh.use_barrier));
+	write(mesh.gravity);
+	write(mesh.lb);
+	write(mesh.ub);
+	write(mesh.x);
+	write(mesh.m);
+
+	// ordinals of the list elements, by slot index
+	auto ordinals = [](const auto &list) {
+		vector<int> res(list.capacity(), -1);
+		int i = 0;
+		for (auto it = list.begin(); it != list.end(); ++it) {
+			res[it.index()] = i++;
+		}
+		return res;
+	};
+	vector<int> vertex_ordinal = ordinals(mesh.vertices);
+	vector<int> segment_ordinal = ordinals(mesh.segments);
+	vector<int> point_ordinal = ordinals(connection_points);
+	vector<int> section_ordinal = ordinals(sections);
+
+	write.size(mesh.vertices.size());
+	for (const Vertex &vertex : mesh.vertices) {
+		if (const Vector2 *fixed = std::get_if<Vector2>(&vertex)) {
+			write(uint8_t(1));
+			write(*fixed);
+		} else {
+			write(uint8_t(0));
+			write(int32_t(std::get<int>(vertex)));
+		}
+		write(vertex.width);
+		write(vertex.mass);
+		write.size(vertex.z.size());
+		for (real z : vertex.z) {
+			write(z);
+		}
+	}
+
+	write.size(mesh.segments.size());
+	for (const Segment &segment : mesh.segments) {
+		write(int32_t(vertex_ordinal[segment.start.index()]));
+		write(int32_t(vertex_ordinal[segment.end.index()]));
+		write(segment.length);
+	}
+
+	write.size(mesh.connection_bends.size());
+	for (auto &bend : mesh.connection_bends) {
+		write(int32_t(segment_ordinal[bend[0].index()]));
+		write(int32_t(segment_ordinal[bend[1].index()]));
+	}
+
+	write.size(mesh.extra_mass.size());
+	for (auto &[vertex, mass] : mesh.extra_mass) {
+		write(int32_t(vertex_ordinal[vertex.index()]));
+		write(mass);
+	}
+
+	write.size(mesh.external_forces.size());
+	for (auto &[vertex, force] : mesh.external_forces) {
+		write(int32_t(vertex_ordinal[vertex.index()]));
+		write(force);
+	}
 
+	write.size(connection_points.size());
+	for (const ConnectionPoint &point : connection_points) {
+		write(point.position);
+		write(int32_t(vertex_ordinal[point.mesh_vertex.index()]));
+		write(int32_t(point.last_direction));
+		for (int side = 0; side < 2; side++) {
+			write.size(point.connecting_segments[side].size());
+			for (auto segment : point.connecting_segments[side]) {
+				write(int32_t(segment_ordinal[segment.index()]));
+			}
+		}
+	}
+
+	write.size(sections.size());
+	for (const Section &section : sections) {
+		write(int32_t(point_ordinal[section.start.index()]));
+		write(int32_t(point_ordinal[section.end.index()]));
+		write(section.length);
+		write(int32_t(section.type));
+		write.size(section.mesh_segments.size());
+		for (auto segment : section.mesh_segments) {
+			write(int32_t(segment_ordinal[segment.index()]));
+		}
+	}
+
+	write.size(outline_sections.size());
+	for (const OutlineSection &outline : outline_sections) {
+		write(int32_t(section_ordinal[outline.section.index()]));
+		write(uint8_t(outline.reversed));
+	}
 }
 
 void Ruffle::Deserialize(const std::vector<char> &buffer) {
+	// scenes saved before ruffles were serialized
+	if (buffer.empty()) {
+		return;
+	}
 
+	Reader read(buffer);
+	for (char c : serialization_magic) {
+		if (read.read<char>() != c) {
+			throw std::runtime_error("Not ruffle data");
+		}
+	}
+	if (read.read<int32_t>() != serialization_version) {
+		throw std::runtime_error("Unsupported ruffle data version");
+	}
+
+	// built aside, so that this ruffle stays untouched if the data is corrupt
+	Ruffle res;
+	res.h = read.read<real>();
+	res.multires_levels = read.read<int32_t>();
+	res.multires_factor = read.read<int32_t>();
+	res.solve_settings.max_steps = read.read<int32_t>();
+	res.solve_settings.gradient_tolerance = read.read<real>();
+	res.solve_settings.energy_tolerance = read.read<real>();
+	res.solve_settings.max_time = read.read<real>();
+
+	SimulationMesh &mesh = res.simulation_mesh;
+	mesh.k_global = read.read<real>();
+	mesh.k_bend = read.read<real>();
+	mesh.density = read.read<real>();
+	mesh.lambda_membrane = read.read<real>();
+	mesh.lambda_air_mesh = read.read<real>();
+	mesh.use_barrier = read.read<uint8_t>();
+	mesh.gravity = read.vector2();
+	mesh.lb = read.vector2();
+	mesh.ub = read.vector2();
+	mesh.x = read.vectorx();
+	mesh.m = read.vectorx();
+	if (mesh.x.size() % 2 != 0 || mesh.m.size() != mesh.x.size()) {
+		throw std::runtime_error("Corrupt ruffle data: inconsistent degrees of freedom");
+	}
+
+	// the movable vertices have to use every pair of x exactly once
+	vector<bool> free_used(mesh.dof()/2, false);
+	int n_free = 0;
+	vector<listref<Vertex>> vertex_refs(read.size());
+	mesh.vertices.reserve(vertex_refs.size());
+	for (auto &vertex : vertex_refs) {
+		if (read.read<uint8_t>()) {
+			vertex = mesh.vertices.insert(mesh.vertices.end(), Vertex(read.vector2()));
+		} else {
+			int ix = read.index(mesh.dof()/2);
+			if (free_used[ix]) {
+				throw std::runtime_error("Corrupt ruffle data: degree of freedom used twice");
+			}
+			free_used[ix] = true;
+			n_free++;
+			vertex = mesh.vertices.insert(mesh.vertices.end(), Vertex(ix));
+		}
+		vertex->width = read.read<real>();
+		vertex->mass = read.read<real>();
+		vertex->z.resize(read.size());
+		for (real &z : vertex->z) {
+			z = read.read<real>();
+		}
+	}
+	if (n_free != mesh.dof()/2) {
+		throw std::runtime_error("Corrupt ruffle data: unused degrees of freedom");
+	}
+
+	vector<listref<Segment>> segment_refs(read.size());
+	mesh.segments.reserve(segment_refs.size());
+	for (auto &segment : segment_refs) {
+		listref<Vertex> start = vertex_refs[read.index(vertex_refs.size())];
+		listref<Vertex> end = vertex_refs[read.index(vertex_refs.size())];
+		// consecutive segments form the chain the bending energy runs along
+		if (!mesh.segments.empty() && mesh.segments.back().end != start) {
+			throw std::runtime_error("Corrupt ruffle data: segments don't form a chain");
+		}
+		segment = mesh.segments.insert(mesh.segments.end(), Segment(start, end, read.read<real>()));
+	}
+
+	mesh.connection_bends.resize(read.size());
+	for (auto &bend : mesh.connection_bends) {
+		bend[0] = segment_refs[read.index(segment_refs.size())];
+		bend[1] = segment_refs[read.index(segment_refs.size())];
+		int shared = 0;
+		for (auto a : {bend[0]->start, bend[0]->end}) {
+			for (auto b : {bend[1]->start, bend[1]->end}) {
+				shared += a == b;
+			}
+		}
+		if (shared != 1) {
+			throw std::runtime_error("Corrupt ruffle data: bend segments don't share one vertex");
+		}
+	}
+
+	mesh.extra_mass.resize(read.size());
+	for (auto &[vertex, mass] : mesh.extra_mass) {
+		vertex = vertex_refs[read.index(vertex_refs.size())];
+		mass = read.read<real>();
+	}
+
+	mesh.external_forces.resize(read.size());
+	for (auto &[vertex, force] : mesh.external_forces) {
+		vertex = vertex_refs[read.index(vertex_refs.size())];
+		force = read.vector2();
+	}
+
+	vector<listref<ConnectionPoint>> point_refs(read.size());
+	res.connection_points.reserve(point_refs.size());
+	for (auto &point : point_refs) {
+		Vector2 position = read.vector2();
+		listref<Vertex> vertex = vertex_refs[read.index(vertex_refs.size())];
+		point = res.connection_points.insert(res.connection_points.end(), ConnectionPoint(position, vertex));
+		point->last_direction = read.index(2);
+		for (int side = 0; side < 2; side++) {
+			point->connecting_segments[side].resize(read.size());
+			for (auto &segment : point->connecting_segments[side]) {
+				segment = segment_refs[read.index(segment_refs.size())];
+			}
+		}
+	}
+
+	vector<listref<Section>> section_refs(read.size());
+	res.sections.reserve(section_refs.size());
+	for (auto &section : section_refs) {
+		listref<ConnectionPoint> start = point_refs[read.index(point_refs.size())];
+		listref<ConnectionPoint> end = point_refs[read.index(point_refs.size())];
+		section = res.sections.insert(res.sections.end(), Section(start, end, read.read<real>()));
+		section->type = Section::Type(read.index(int(Section::Type::DensifiedCurved)+1));
+		section->mesh_segments.resize(read.size());
+		for (auto &segment : section->mesh_segments) {
+			segment = segment_refs[read.index(segment_refs.size())];
+		}
+	}
+
+	int outline_count = read.size();
+	for (int i = 0; i < outline_count; i++) {
+		listref<Section> section = section_refs[read.index(section_refs.size())];
+		res.outline_sections.emplace_back(section, bool(read.read<uint8_t>()));
+	}
+
+	if (!read.at_end()) {
+		throw std::runtime_error("Corrupt ruffle data: trailing bytes");
+	}
+
+	// the air mesh is generated again by the next physics_solve
+	mesh.invalidate_topology();
+	res.simulator = std::move(simulator);
+	*this = std::move(res);
 }
 
 std::ostream &operator<<(std::ostream &os, const Ruffle::ConnectionPoint &point) {
@@ -1049,4 +1672,22 @@ std::ostream &operator<<(std::ostream &os, const Ruffle::OutlineSection &sec) {
 		<< "}";
 }
 
+std::ostream &operator<<(std::ostream &os, const Ruffle::SolveReport &report) {
+	return os << "SolveReport {"
+		<< "stop: " << report.stop_name() << ", "
+		<< "steps: " << report.steps << ", "
+		<< "energy evaluations: " << report.energy_evaluations << ", "
+		<< "gradient evaluations: " << report.gradient_evaluations << ", "
+		<< "relax: " << report.relax_flips << "/" << report.relax_calls << ", "
+		<< "energy: " << report.energy << ", "
+		<< "gradient norm: " << report.gradient_norm << ", "
+		<< "time: " << report.total_time << "s "
+		<< "(energy " << report.energy_time << "s, "
+		<< "line search " << report.line_search_time << "s, "
+		<< "relax " << report.relax_time << "s, "
+		<< "coarse " << report.coarse_time << "s, "
+		<< "solver " << report.solver_time << "s)"
+		<< "}";
+}
+
 }
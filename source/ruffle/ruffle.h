@@ -45,6 +45,8 @@ public:
 
 
 		vector<listref<simulation::SimulationMesh::Segment>> mesh_segments;
+		// length last written to mesh_segments, see update_simulation_mesh
+		real mesh_length = -1.;
 
 		Section(listref<ConnectionPoint> _start, listref<ConnectionPoint> _end, real _length)
 			: start(_start), end(_end), length(_length)
@@ -74,13 +76,56 @@ public:
 		}
 	};
 
+	/// Stopping criteria of physics_solve besides the simulator converging,
+	/// tolerances of 0 are disabled
+	struct SolveSettings {
+		int max_steps = 1000;
+		real gradient_tolerance = 0.; // on the norm of the projected gradient
+		real energy_tolerance = 0.; // on the relative energy decrease of a step
+		real max_time = infinity; // seconds
+	};
+
+	struct SolveReport {
+		enum class Stop {
+			NoSimulator,
+			Converged, // the simulator says so
+			Gradient,
+			Energy,
+			EnergyIncrease, // a step went uphill
+			StepLimit,
+			TimeLimit,
+		};
+		Stop stop = Stop::NoSimulator;
+
+		int steps = 0;
+		int energy_evaluations = 0;
+		int gradient_evaluations = 0;
+		int relax_calls = 0;
+		int relax_flips = 0; // relaxations that changed the air mesh
+
+		real energy = 0.;
+		real gradient_norm = 0.; // projected onto the bounds
+
+		// seconds, solver_time is everything but energy, relax and coarse levels
+		real total_time = 0.;
+		real energy_time = 0.;
+		real relax_time = 0.;
+		real coarse_time = 0.;
+		real solver_time = 0.;
+		// Newton and LBFGS line searches, overlaps energy_time and solver_time.
+		// Without warm_start, LBFGSpp's line search isn't measured.
+		real line_search_time = 0.;
+
+		const char *stop_name() const;
+	};
+
 	simulation::SimulationMesh simulation_mesh;
 	std::unique_ptr<simulation::Simulator> simulator;
 
-	list<ConnectionPoint> connection_points;
-	list<Section> sections;
+	slot_list<ConnectionPoint> connection_points;
+	slot_list<Section> sections;
 
-	list<OutlineSection> outline_sections;
+	slot_list<OutlineSection> outline_sections;
 
 	real h;
 
@@ -108,8 +153,20 @@ public:
 
 	Vector2 get_tangent(ConnectionPoint &p);
 
+	/// Writes the section lengths to the mesh segments, splitting segments
+	/// longer than 2h. Only sections whose length changed since the last call
+	/// are touched, unless the mesh topology was changed in the meantime.
+	/// Vertex widths changed outside need SimulationMesh::update_vertex_mass.
 	void update_simulation_mesh();
-	void physics_solve();
+	SolveReport physics_solve();
+
+	SolveSettings solve_settings;
+	SolveReport last_solve_report;
+
+	// number of coarsened copies solved before the full resolution, each
+	// merging about multires_factor segments per section; 0 disables
+	int multires_levels = 0;
+	int multires_factor = 4;
 
 	real last_physics_solve_time = 0.;
 	real physics_solve_total_time = 0.;
@@ -117,44 +174,18 @@ public:
 
 	void verify();
 
-	Ruffle clone() { // const
-		struct DefaultTr: 
-			public Translate<simulation::SimulationMesh::Vertex>,
-			public Translate<simulation::SimulationMesh::Segment>,
-			public Translate<ConnectionPoint>,
-			public Translate<Section>
-		{
-			using Translate<simulation::SimulationMesh::Vertex>::operator();
-			using Translate<simulation::SimulationMesh::Segment>::operator();
-			using Translate<ConnectionPoint>::operator();
-			using Translate<Section>::operator();
-			using Translate<simulation::SimulationMesh::Vertex>::transform;
-			using Translate<simulation::SimulationMesh::Segment>::transform;
-			using Translate<ConnectionPoint>::transform;
-			using Translate<Section>::transform;
-		} tr;
-		return clone(tr);
-	}
-	template<typename Tr>
-	Ruffle clone(Tr &tr = Tr()) { // const
-		Ruffle res;
-		res.simulation_mesh = simulation_mesh.clone(tr);
-		//res.simulator = /// ?;
-		tr.transform(connection_points.begin(), connection_points.end(), res.connection_points, [&](ConnectionPoint x) {
-			ConnectionPoint new_point(x.position, tr(x.mesh_vertex));
-			new_point.last_direction = x.last_direction;
-			for (int side = 0; side < 2; side++) {
-				std::transform(x.connecting_segments[side].begin(), x.connecting_segments[side].end(), std::back_inserter(new_point.connecting_segments[side]), tr);
-			}
-			return new_point;
-		});
-		std::transform(sections.begin(), sections.end(), std::back_inserter(res.sections), [&](Section x) {
-			Section new_section(tr(x.start), tr(x.end), x.length);
-			std::transform(x.mesh_segments.begin(), x.mesh_segments.end(), std::back_inserter(new_section.mesh_segments), tr);
-			return new_section;
-		});
-		return res;
-	}
+private:
+	void multires_solve();
+	// update_vertex_mass() for the vertices of a section
+	void update_section_mass(Section &section);
+
+	// topology_version of the mesh after the last update_simulation_mesh
+	long updated_topology_version = -1;
+
+public:
+	/// Deep copy including the simulator state. The lists are copied as a
+	/// whole and references translated by slot index, see Translate.
+	Ruffle clone() const;
 
 	virtual void Serialize(std::vector<char> &buffer) const override;
 	virtual void Deserialize(const std::vector<char> &buffer) override;
@@ -163,6 +194,7 @@ public:
 std::ostream &operator<<(std::ostream &, const Ruffle::ConnectionPoint &);
 std::ostream &operator<<(std::ostream &, const Ruffle::Section &);
 std::ostream &operator<<(std::ostream &, const Ruffle::OutlineSection &);
+std::ostream &operator<<(std::ostream &, const Ruffle::SolveReport &);
 
 }
 
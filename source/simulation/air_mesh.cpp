@@ -1,9 +1,9 @@
 #include "simulation/air_mesh.h"
 #include "simulation/simulation_mesh.h"
+#include "common/thread_pool.h"
 #include <unordered_map>
-
-// for listref_hash<T>
-#include "common/clone_helper.h"
+#include <unordered_set>
+#include <queue>
 
 namespace ruffles::simulation {
 
@@ -12,7 +12,7 @@ AirMesh::AirMesh() {
 
 AirMesh::AirMesh(SimulationMesh &mesh) {
 	vector<CDT::Vertex_handle> cdt_vertices;
-	std::unordered_map<listref<SimulationMesh::Vertex>, int, listref_hash<SimulationMesh::Vertex>> indices;
+	vector<int> indices(mesh.vertices.capacity(), -1);
 
 	int i = 0;
 	for (auto it = mesh.vertices.begin(); it != mesh.vertices.end(); ++it) {
@@ -21,24 +21,54 @@ AirMesh::AirMesh(SimulationMesh &mesh) {
 		vh->info() = i;
 		cdt_vertices.push_back(vh);
 		vertices.push_back(static_cast<std::variant<Vector2,int>>(*it));
+		set_handle(it.id(), vh);
 
-		indices.insert({it, i});
+		indices[it.index()] = i;
 
 		i++;
 	}
 	for (auto seg : mesh.segments) {
-		CDT::Vertex_handle a = cdt_vertices[indices[seg.start]];
-		CDT::Vertex_handle b = cdt_vertices[indices[seg.end]];
+		CDT::Vertex_handle a = cdt_vertices[indices[seg.start.index()]];
+		CDT::Vertex_handle b = cdt_vertices[indices[seg.end.index()]];
 		cdt.insert_constraint(a, b);
 	}
 
+	handles_valid = true;
+
 	relax(mesh.x);
 }
 
+AirMesh::AirMesh(const AirMesh &other)
+	: cdt(other.cdt), vertices(other.vertices), version(other.version),
+	relax_threshold(other.relax_threshold), full_relax_interval(other.full_relax_interval),
+	barrier_area(other.barrier_area), max_project_passes(other.max_project_passes)
+{
+}
+
+AirMesh &AirMesh::operator=(const AirMesh &other) {
+	cdt = other.cdt;
+	vertices = other.vertices;
+	version = other.version;
+	relax_threshold = other.relax_threshold;
+	full_relax_interval = other.full_relax_interval;
+	barrier_area = other.barrier_area;
+	max_project_passes = other.max_project_passes;
+	handles.clear();
+	orphans.clear();
+	handles_valid = false;
+	relaxed_version = -1;
+	dof_vertices.clear();
+	return *this;
+}
+
 
 void AirMesh::clear() {
 	cdt.clear();
 	vertices.clear();
+	handles.clear();
+	orphans.clear();
+	handles_valid = false;
+	version = next_version();
 }
 
 bool AirMesh::empty() const {
@@ -80,39 +110,358 @@ bool AirMesh::relax(const VectorX &x) {
 		return area / (ab.squaredNorm() + ac.squaredNorm() + bc.squaredNorm());
 	};
 
-	bool any_flips = false;
-	bool has_flips;
-	do {
-		has_flips = false;
+	// the quality of the worse face at the edge improves by this much when flipping it
+	auto flip_gain = [&](CDT::Face_handle f1, int i) -> real {
+		auto f2 = f1->neighbor(i);
+		auto a = f1->vertex(i);
+		auto b = f1->vertex((i+1)%3);
+		auto c = f1->vertex((i+2)%3);
+		auto d = f2->vertex(f2->index(f1));
+
+		real old_quality = min(quality(a,b,c), quality(b,d,c));
+		real new_quality = min(quality(a,b,d), quality(a,d,c));
+		return std::isfinite(old_quality) ? new_quality - old_quality : -infinity;
+	};
+
+	// edges are kept by their end points, since flips invalidate face handles.
+	// The best flip goes first.
+	struct Candidate {
+		real gain;
+		CDT::Vertex_handle u, v;
+		bool operator<(const Candidate &other) const {
+			return gain < other.gain;
+		}
+	};
+	std::priority_queue<Candidate> queue;
+	auto push = [&](CDT::Face_handle f, int i) {
+		auto u = f->vertex((i+1)%3);
+		auto v = f->vertex((i+2)%3);
+		if (cdt.is_infinite(u) || cdt.is_infinite(v) || f->is_constrained(i)) {
+			// don't flip constrained edges
+			return;
+		}
+		real gain = flip_gain(f, i);
+		if (gain > 0) {
+			queue.push({gain, u, v});
+		}
+	};
+
+	if (relaxed_version != version || seeded_x.size() != x.size() || ++relaxes_since_full >= full_relax_interval) {
+		// the triangulation changed since the last call, or it's time for a
+		// full pass: start from all edges
 		for (auto edge = cdt.edges_begin(); edge != cdt.edges_end(); ++edge) {
-			if (cdt.is_constrained(*edge)) {
-				// don't flip constrained edges
-				continue;
+			push(edge->first, edge->second);
+		}
+		relaxes_since_full = 0;
+		seeded_x = x;
+		dof_vertices.assign(x.size()/2, CDT::Vertex_handle());
+		for (auto v = cdt.finite_vertices_begin(); v != cdt.finite_vertices_end(); ++v) {
+			if (const int *ix = get_if<int>(&vertices[v->info()])) {
+				dof_vertices[*ix] = v;
 			}
-			auto f1 = edge->first;
-			auto f2 = f1->neighbor(edge->second);
-
-			bool flip = false;
-			auto a = f1->vertex(edge->second);
-			auto b = f1->vertex((edge->second+1)%3);
-			auto c = f1->vertex((edge->second+2)%3);
-			auto d = f2->vertex(f2->index(f1));
-
-			real old_quality = min(quality(a,b,c), quality(b,d,c));
-			real new_quality = min(quality(a,b,d), quality(a,d,c));
-
-			flip = std::isfinite(old_quality) ? new_quality > old_quality : false;
-			if (flip) {
-				cdt.flip(f1, edge->second);
-				has_flips = true;
-				any_flips = true;
+		}
+	} else {
+		// only the faces around vertices that moved enough can have changed their mind
+		for (int i = 0; i < x.size()/2; i++) {
+			if (dof_vertices[i] == CDT::Vertex_handle() ||
+			    (x.segment<2>(2*i) - seeded_x.segment<2>(2*i)).norm() <= relax_threshold) {
+				continue;
 			}
+			seeded_x.segment<2>(2*i) = x.segment<2>(2*i);
+			auto f = cdt.incident_faces(dof_vertices[i]);
+			auto done = f;
+			do {
+				for (int j = 0; j < 3; j++) {
+					push(f, j);
+				}
+			} while (++f != done);
 		}
-	} while (has_flips);
+	}
+
+	bool any_flips = false;
+	while (!queue.empty()) {
+		Candidate candidate = queue.top();
+		queue.pop();
+
+		CDT::Face_handle f1;
+		int i;
+		if (!cdt.is_edge(candidate.u, candidate.v, f1, i) || flip_gain(f1, i) <= 0) {
+			// flipped away or made worthless by an earlier flip
+			continue;
+		}
+		auto f2 = f1->neighbor(i);
+		cdt.flip(f1, i);
+		any_flips = true;
+		// the outer edges of the quadrilateral see a new face
+		for (int j = 0; j < 3; j++) {
+			push(f1, j);
+			push(f2, j);
+		}
+	}
 
+	if (any_flips) {
+		version = next_version();
+	}
+	relaxed_version = version;
 	return any_flips;
 }
 
+static Vector2 vertex_position(const AirMesh::MeshVertex &v, const VectorX &x) {
+	if (auto fixed = get_if<Vector2>(&v)) {
+		return *fixed;
+	}
+	return x.segment<2>(2*std::get<int>(v));
+}
+
+static const AirMesh::MeshVertex &mesh_vertex(SimulationMesh &mesh, AirMesh::VertexId id) {
+	auto it = mesh.vertices.at_index(slot_index_of_id(id));
+	assert(it.id() == id);
+	return *it;
+}
+
+static void mark_constrained(CDT &cdt, CDT::Face_handle f, int i, bool constrained) {
+	f->set_constraint(i, constrained);
+	f->neighbor(i)->set_constraint(cdt.mirror_index(f,i), constrained);
+}
+
+bool AirMesh::update_handles(SimulationMesh &mesh) {
+	if (handles_valid) {
+		return true;
+	}
+	// vertex i of the air mesh is the i-th vertex of the simulation mesh, new
+	// vertices of either are appended at the end
+	if (mesh.vertices.size() < vertices.size() || cdt.number_of_vertices() != vertices.size()) {
+		return false;
+	}
+	vector<CDT::Vertex_handle> by_index(vertices.size());
+	for (auto v = cdt.finite_vertices_begin(); v != cdt.finite_vertices_end(); ++v) {
+		by_index[v->info()] = v;
+	}
+	handles.clear();
+	orphans.clear();
+	auto it = mesh.vertices.begin();
+	for (size_t i = 0; i < vertices.size(); ++i, ++it) {
+		set_handle(it.id(), by_index[i]);
+	}
+	handles_valid = true;
+	return true;
+}
+
+CDT::Vertex_handle AirMesh::handle(VertexId id) const {
+	size_t slot = slot_index_of_id(id);
+	if (slot < handles.size() && handles[slot].id == id) {
+		return handles[slot].vertex;
+	}
+	return CDT::Vertex_handle();
+}
+
+void AirMesh::set_handle(VertexId id, CDT::Vertex_handle vertex) {
+	size_t slot = slot_index_of_id(id);
+	if (slot >= handles.size()) {
+		handles.resize(slot+1);
+	}
+	if (handles[slot].vertex != CDT::Vertex_handle() && handles[slot].id != id) {
+		// the previous vertex in this slot was erased, cleanup() still has to
+		// remove it from the triangulation
+		orphans.push_back(handles[slot].vertex);
+	}
+	handles[slot] = {id, vertex};
+}
+
+bool AirMesh::move_points(const VectorX &x) {
+	for (auto v = cdt.finite_vertices_begin(); v != cdt.finite_vertices_end(); ++v) {
+		Vector2 p = vertex_position(vertices[v->info()], x);
+		v->set_point(Point(p(0), p(1)));
+	}
+	for (auto f = cdt.finite_faces_begin(); f != cdt.finite_faces_end(); ++f) {
+		if (cdt.orientation(f->vertex(0)->point(), f->vertex(1)->point(), f->vertex(2)->point()) != CGAL::LEFT_TURN) {
+			return false;
+		}
+	}
+	// point location also needs a convex hull. Going around the infinite faces
+	// (inf, p, q) the hull is traversed clockwise.
+	auto f = cdt.incident_faces(cdt.infinite_vertex());
+	auto done = f;
+	do {
+		int j = f->index(cdt.infinite_vertex());
+		CDT::Vertex_handle p = f->vertex((j+1)%3);
+		CDT::Vertex_handle q = f->vertex((j+2)%3);
+		CDT::Face_handle next = f->neighbor((j+1)%3);
+		CDT::Vertex_handle r = next->vertex((next->index(q)+1)%3);
+		if (cdt.orientation(p->point(), q->point(), r->point()) == CGAL::LEFT_TURN) {
+			return false;
+		}
+	} while (++f != done);
+	return true;
+}
+
+bool AirMesh::split(SimulationMesh &mesh, VertexId start, VertexId end, VertexId center) {
+	// the insertion restores the Delaunay property around the new vertex
+	if (!update_handles(mesh) || !move_points(mesh.x)) {
+		return false;
+	}
+	CDT::Vertex_handle a = handle(start);
+	CDT::Vertex_handle b = handle(end);
+	if (a == CDT::Vertex_handle() || b == CDT::Vertex_handle()) {
+		return false;
+	}
+	CDT::Face_handle f;
+	int i;
+	if (!cdt.is_edge(a, b, f, i)) {
+		return false;
+	}
+
+	// inserting on the constrained edge splits the constraint and sets the
+	// flags of all faces around the new vertex, unlike the bare data structure
+	const MeshVertex &center_vertex = mesh_vertex(mesh, center);
+	Vector2 p = vertex_position(center_vertex, mesh.x);
+	CDT::Vertex_handle center_vx = cdt.insert(Point(p(0), p(1)), CDT::EDGE, f, i);
+	center_vx->info() = vertices.size();
+	vertices.push_back(center_vertex);
+	set_handle(center, center_vx);
+
+	version = next_version();
+	return true;
+}
+
+bool AirMesh::insert(SimulationMesh &mesh, VertexId id) {
+	if (!update_handles(mesh) || !move_points(mesh.x)) {
+		return false;
+	}
+	const MeshVertex &v = mesh_vertex(mesh, id);
+	Vector2 x = vertex_position(v, mesh.x);
+	Point p(x(0), x(1));
+	CDT::Locate_type lt;
+	int li;
+	CDT::Face_handle loc = cdt.locate(p, lt, li);
+	if (lt == CDT::VERTEX || (lt == CDT::EDGE && loc->is_constrained(li))) {
+		// would merge with a vertex or cut a constraint
+		return false;
+	}
+	CDT::Vertex_handle vh = cdt.insert(p, lt, loc, li);
+	vh->info() = vertices.size();
+	vertices.push_back(v);
+	set_handle(id, vh);
+
+	version = next_version();
+	return true;
+}
+
+bool AirMesh::insert_constraint(SimulationMesh &mesh, VertexId a, VertexId b) {
+	if (!update_handles(mesh)) {
+		return false;
+	}
+	CDT::Vertex_handle ha = handle(a);
+	CDT::Vertex_handle hb = handle(b);
+	if (ha == CDT::Vertex_handle() || hb == CDT::Vertex_handle()) {
+		return false;
+	}
+	CDT::Face_handle f;
+	int i;
+	if (cdt.is_edge(ha, hb, f, i) && f->is_constrained(i)) {
+		// already there, e.g. after split()
+		return true;
+	}
+	if (!move_points(mesh.x)) {
+		return false;
+	}
+	try {
+		cdt.insert_constraint(ha, hb);
+	} catch (...) {
+		// crosses another constraint
+		return false;
+	}
+
+	version = next_version();
+	return true;
+}
+
+bool AirMesh::cleanup(SimulationMesh &mesh, const vector<int> &newindex) {
+	if (!handles_valid && mesh.vertices.size() != vertices.size()) {
+		// vertices were erased before the handles could be rebuilt
+		return false;
+	}
+	if (!update_handles(mesh)) {
+		return false;
+	}
+
+	// every vertex must be known, all other handles belong to erased vertices
+	vector<bool> alive(handles.size(), false);
+	for (auto it = mesh.vertices.begin(); it != mesh.vertices.end(); ++it) {
+		if (handle(it.id()) == CDT::Vertex_handle()) {
+			return false;
+		}
+		alive[it.index()] = true;
+	}
+	vector<CDT::Vertex_handle> removed = std::move(orphans);
+	orphans.clear();
+	for (size_t slot = 0; slot < handles.size(); slot++) {
+		if (!alive[slot] && handles[slot].vertex != CDT::Vertex_handle()) {
+			removed.push_back(handles[slot].vertex);
+			handles[slot] = Handle();
+		}
+	}
+	if (!removed.empty()) {
+		if (!move_points(mesh.x)) {
+			return false;
+		}
+		for (auto vh : removed) {
+			cdt.remove_incident_constraints(vh);
+			cdt.remove(vh);
+		}
+	}
+
+	// renumber in the order of the simulation mesh, with the new dof indices
+	vertices.clear();
+	for (auto it = mesh.vertices.begin(); it != mesh.vertices.end(); ++it) {
+		handle(it.id())->info() = vertices.size();
+		MeshVertex w = *it;
+		if (int *ix = get_if<int>(&w)) {
+			*ix = newindex[*ix];
+		}
+		vertices.push_back(w);
+	}
+
+	// erased segments between surviving vertices leave their constraint behind
+	std::unordered_set<long> constrained;
+	for (auto &seg : mesh.segments) {
+		long a = handle(seg.start.id())->info();
+		long b = handle(seg.end.id())->info();
+		constrained.insert(std::min(a,b) * vertices.size() + std::max(a,b));
+	}
+	for (auto edge = cdt.finite_edges_begin(); edge != cdt.finite_edges_end(); ++edge) {
+		if (!cdt.is_constrained(*edge)) {
+			continue;
+		}
+		long a = edge->first->vertex((edge->second+1)%3)->info();
+		long b = edge->first->vertex((edge->second+2)%3)->info();
+		if (!constrained.count(std::min(a,b) * vertices.size() + std::max(a,b))) {
+			mark_constrained(cdt, edge->first, edge->second, false);
+		}
+	}
+
+	version = next_version();
+	return true;
+}
+
+const vector<array<int, 3>> &AirMesh::faces() const {
+	if (face_cache_version != version) {
+		face_cache.clear();
+		for (auto face = cdt.finite_faces_begin(); face != cdt.finite_faces_end(); ++face) {
+			face_cache.push_back({
+				face->vertex(0)->info(),
+				face->vertex(1)->info(),
+				face->vertex(2)->info(),
+			});
+		}
+		face_cache_version = version;
+	}
+	return face_cache;
+}
+
+// below this many faces the penalty is not worth distributing over threads
+static const int min_parallel_faces = 4096;
+
 real AirMesh::penalty(real k, const VectorX &x, VectorX *grad) const {
 	auto get_vertex_position = [&](int ix) -> Vector2 {
 		Vector2 res;
@@ -124,7 +473,96 @@ real AirMesh::penalty(real k, const VectorX &x, VectorX *grad) const {
 		}
 		return res;
 	};
+	const vector<array<int, 3>> &fs = faces();
+
+	ThreadPool &pool = ThreadPool::global();
+	bool parallel = (int)fs.size() >= min_parallel_faces && pool.size() > 1;
+	int n_chunks = parallel ? pool.size() : 1;
+
+	// only inverted faces contribute, so each chunk keeps a short list of
+	// gradients that is scattered afterwards instead of a full buffer
+	vector<real> chunk_res(n_chunks, 0.);
+	vector<vector<pair<int, Vector6>>> chunk_grad(n_chunks);
+
+	auto run = [&](int chunk, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			Vector2 a = get_vertex_position(fs[i][0]);
+			Vector2 b = get_vertex_position(fs[i][1]);
+			Vector2 c = get_vertex_position(fs[i][2]);
+
+			auto ab = b-a;
+			auto ac = c-a;
+			auto bc = c-b;
+			real area = ab.x() * ac.y() - ab.y() * ac.x();
+
+			//real circumference = ab.norm() + ac.norm() + bc.norm();
+
+			if (area >= 0) {
+				continue;
+			}
+			// TODO: divide by circumference for multiresolution?
+			real penalty = -area ; // /circumference;
+			chunk_res[chunk] += k * penalty;
+
+			if (grad) {
+				Vector6 dpenalty;
+				dpenalty <<
+					 bc.y(), -bc.x(),
+					-ac.y(),  ac.x(),
+					 ab.y(), -ab.x();
+				chunk_grad[chunk].emplace_back(i, k * dpenalty);
+			}
+		}
+	};
+	if (parallel) {
+		pool.parallel_for(fs.size(), run);
+	} else {
+		run(0, 0, fs.size());
+	}
+
 	real res = 0;
+	for (int chunk = 0; chunk < n_chunks; chunk++) {
+		res += chunk_res[chunk];
+		for (auto &[i, g] : chunk_grad[chunk]) {
+			for (int j = 0; j < 3; j++) {
+				if (const int *ix = get_if<int>(&vertices[fs[i][j]])) {
+					grad->segment<2>(2**ix) += g.segment<2>(2*j);
+				}
+			}
+		}
+	}
+	return res;
+}
+// the (doubled) area is bilinear in the corner positions, so its hessian is constant
+static Matrix6 area_hessian() {
+	Matrix2 r;
+	r << 0., 1.,
+	    -1., 0.;
+	Matrix6 res;
+	res <<
+		Matrix2::Zero(),              r,             -r,
+		  r.transpose(), Matrix2::Zero(),              r,
+		 -r.transpose(),   r.transpose(), Matrix2::Zero();
+	return res;
+}
+
+void AirMesh::hessian(real k, const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project) const {
+	auto get_vertex_position = [&](int ix) -> Vector2 {
+		Vector2 res;
+		if (auto fixed = get_if<Vector2>(&vertices[ix])) {
+			res = *fixed;
+		}
+		if (auto index = get_if<int>(&vertices[ix])) {
+			res = x.segment<2>(2**index);
+		}
+		return res;
+	};
+
+	Matrix6 inverted = -k * area_hessian();
+	if (project) {
+		inverted = project_psd<6>(inverted);
+	}
+
 	for (auto face = cdt.finite_faces_begin(); face != cdt.finite_faces_end(); ++face) {
 		Vector2 a = get_vertex_position(face->vertex(0)->info());
 		Vector2 b = get_vertex_position(face->vertex(1)->info());
@@ -132,118 +570,214 @@ real AirMesh::penalty(real k, const VectorX &x, VectorX *grad) const {
 
 		auto ab = b-a;
 		auto ac = c-a;
-		auto bc = c-b;
 		real area = ab.x() * ac.y() - ab.y() * ac.x();
 
-		//real circumference = ab.norm() + ac.norm() + bc.norm();
+		// emit the block even if it is zero, so the sparsity pattern only
+		// depends on the triangulation
+		real fac = area >= 0 ? 0. : 1.;
+		for (int i = 0; i < 3; i++) {
+			const int *ix = get_if<int>(&vertices[face->vertex(i)->info()]);
+			if (!ix) continue;
+			for (int j = 0; j < 3; j++) {
+				const int *jx = get_if<int>(&vertices[face->vertex(j)->info()]);
+				if (!jx) continue;
+				addHessianBlock((fac * inverted.block<2,2>(2*i, 2*j)).eval(), 2**ix, 2**jx, triplets);
+			}
+		}
+	}
+}
 
-		real penalty;
-		if (area >= 0) {
-			penalty = 0;
-		} else {
-			// TODO: divide by circumference for multiresolution?
-			penalty = -area ; // /circumference;
+// b(a) = -(a - â)² log(a/â) on the doubled area a, zero above â = barrier_area
+// and infinite for inverted triangles
+real AirMesh::barrier(real k, const VectorX &x, VectorX *grad) const {
+	const real ah = barrier_area;
+	real res = 0.;
+	for (auto &f : faces()) {
+		Vector2 a = vertex_position(vertices[f[0]], x);
+		Vector2 b = vertex_position(vertices[f[1]], x);
+		Vector2 c = vertex_position(vertices[f[2]], x);
+
+		auto ab = b-a;
+		auto ac = c-a;
+		auto bc = c-b;
+		real area = ab.x() * ac.y() - ab.y() * ac.x();
+		if (area >= ah) {
+			continue;
+		}
+		if (area <= 0) {
+			return infinity;
 		}
 
-		res += k * penalty;
+		real d = area - ah;
+		real l = std::log(area / ah);
+		res += -k * d*d*l;
 
 		if (grad) {
-			Vector2 darea_da(-bc.y(),  bc.x());
-			Vector2 darea_db( ac.y(), -ac.x());
-			Vector2 darea_dc(-ab.y(),  ab.x());
-
-			Vector2 dpenalty_da = -darea_da;
-			Vector2 dpenalty_db = -darea_db;
-			Vector2 dpenalty_dc = -darea_dc;
-			real fac; // dW/dpenalty
-			fac = k;
-			if (area >= 0) {
-				fac = 0;
-			} else {
+			Vector6 darea;
+			darea <<
+				-bc.y(),  bc.x(),
+				 ac.y(), -ac.x(),
+				-ab.y(),  ab.x();
+			real db = -2*d*l - d*d/area;
+			for (int j = 0; j < 3; j++) {
+				if (const int *ix = get_if<int>(&vertices[f[j]])) {
+					grad->segment<2>(2**ix) += k * db * darea.segment<2>(2*j);
+				}
 			}
-			if (const int *ix = get_if<int>(&vertices[face->vertex(0)->info()])) {
-				grad->segment<2>(2**ix) += fac * dpenalty_da;
+		}
+	}
+	return res;
+}
+
+void AirMesh::barrier_hessian(real k, const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project) const {
+	const real ah = barrier_area;
+	for (auto &f : faces()) {
+		Vector2 a = vertex_position(vertices[f[0]], x);
+		Vector2 b = vertex_position(vertices[f[1]], x);
+		Vector2 c = vertex_position(vertices[f[2]], x);
+
+		auto ab = b-a;
+		auto ac = c-a;
+		auto bc = c-b;
+		real area = ab.x() * ac.y() - ab.y() * ac.x();
+
+		// emit the block even if it is zero, so the sparsity pattern only
+		// depends on the triangulation
+		Matrix6 block = Matrix6::Zero();
+		if (area < ah && area > 0) {
+			Vector6 darea;
+			darea <<
+				-bc.y(),  bc.x(),
+				 ac.y(), -ac.x(),
+				-ab.y(),  ab.x();
+			real d = area - ah;
+			real l = std::log(area / ah);
+			real db = -2*d*l - d*d/area;
+			real d2b = -2*l - 4*d/area + d*d/(area*area);
+			block = k * (d2b * darea * darea.transpose() + db * area_hessian());
+			if (project) {
+				block = project_psd<6>(block);
 			}
-			if (const int *ix = get_if<int>(&vertices[face->vertex(1)->info()])) {
-				grad->segment<2>(2**ix) += fac * dpenalty_db;
+		}
+		for (int i = 0; i < 3; i++) {
+			const int *ix = get_if<int>(&vertices[f[i]]);
+			if (!ix) continue;
+			for (int j = 0; j < 3; j++) {
+				const int *jx = get_if<int>(&vertices[f[j]]);
+				if (!jx) continue;
+				addHessianBlock(block.block<2,2>(2*i, 2*j).eval(), 2**ix, 2**jx, triplets);
 			}
-			if (const int *ix = get_if<int>(&vertices[face->vertex(2)->info()])) {
-				grad->segment<2>(2**ix) += fac * dpenalty_dc;
+		}
+	}
+}
+
+real AirMesh::max_feasible_step(const VectorX &x, const VectorX &dir) const {
+	auto vertex_direction = [&](int ix) -> Vector2 {
+		if (const int *index = get_if<int>(&vertices[ix])) {
+			return dir.segment<2>(2**index);
+		}
+		return Vector2::Zero();
+	};
+	auto cross = [](const Vector2 &u, const Vector2 &v) {
+		return u.x() * v.y() - u.y() * v.x();
+	};
+
+	real res = infinity;
+	for (auto &f : faces()) {
+		Vector2 a = vertex_position(vertices[f[0]], x);
+		Vector2 da = vertex_direction(f[0]);
+		Vector2 ab = vertex_position(vertices[f[1]], x) - a;
+		Vector2 ac = vertex_position(vertices[f[2]], x) - a;
+		Vector2 dab = vertex_direction(f[1]) - da;
+		Vector2 dac = vertex_direction(f[2]) - da;
+
+		// area(t) = c0 + c1 t + c2 t²
+		real c0 = cross(ab, ac);
+		real c1 = cross(ab, dac) + cross(dab, ac);
+		real c2 = cross(dab, dac);
+		if (c0 <= 0) {
+			return 0.;
+		}
+
+		real t = infinity;
+		if (c2 == 0.) {
+			if (c1 < 0) {
+				t = -c0 / c1;
+			}
+		} else {
+			real disc = c1*c1 - 4*c2*c0;
+			if (disc >= 0) {
+				// without cancellation, the roots are q/c2 and c0/q
+				real q = -0.5 * (c1 + std::copysign(std::sqrt(disc), c1));
+				for (real root : {q / c2, c0 / q}) {
+					if (root > 0) {
+						t = min(t, root);
+					}
+				}
 			}
 		}
+		res = min(res, t);
 	}
 	return res;
 }
-real AirMesh::barrier(real k, const VectorX &x, VectorX *grad) const {
-	(void)k;
-	(void)x;
-	(void)grad;
-	// TODO
-	return 0.;
-}
-void AirMesh::project(VectorX &x) const {
+bool AirMesh::project(VectorX &x) const {
 	if (empty()) {
-		return;
+		return true;
 	}
-	auto get_vertex_position = [&](int ix) -> Vector2 {
-		Vector2 res;
-		if (auto fixed = get_if<Vector2>(&vertices[ix])) {
-			res = *fixed;
-		}
-		if (auto index = get_if<int>(&vertices[ix])) {
-			res = x.segment<2>(2**index);
-		}
-		return res;
-	};
 
-	bool changed;
-	do {
-		changed = false;
+	for (int pass = 0; pass < max_project_passes; pass++) {
+		bool changed = false;
 
-		for (auto face = cdt.finite_faces_begin(); face != cdt.finite_faces_end(); ++face) {
-			Vector2 a = get_vertex_position(face->vertex(0)->info());
-			Vector2 b = get_vertex_position(face->vertex(1)->info());
-			Vector2 c = get_vertex_position(face->vertex(2)->info());
+		for (auto &f : faces()) {
+			Vector2 a = vertex_position(vertices[f[0]], x);
+			Vector2 b = vertex_position(vertices[f[1]], x);
+			Vector2 c = vertex_position(vertices[f[2]], x);
 
 			auto ab = b-a;
 			auto ac = c-a;
 			auto bc = c-b;
 			real area = ab.x() * ac.y() - ab.y() * ac.x();
 
+			// aim for the margin but accept a bit less, so rounding can't keep
+			// the passes going
 			real constraint = area - 1e-3;
-			if (constraint < 0) {
-				changed = true;
-
-				// Newton-raphson constraint solver
-				Vector2 darea_da(-bc.y(),  bc.x());
-				Vector2 darea_db( ac.y(), -ac.x());
-				Vector2 darea_dc(-ab.y(),  ab.x());
+			if (constraint >= -1e-4) {
+				continue;
+			}
 
-				real sqnorm = 0.;
-				if (const int *ix = get_if<int>(&vertices[face->vertex(0)->info()])) {
-					sqnorm += darea_da.squaredNorm();
-				}
-				if (const int *ix = get_if<int>(&vertices[face->vertex(1)->info()])) {
-					sqnorm += darea_db.squaredNorm();
-				}
-				if (const int *ix = get_if<int>(&vertices[face->vertex(2)->info()])) {				
-					sqnorm += darea_dc.squaredNorm();
+			// Newton-raphson constraint solver
+			array<Vector2, 3> darea = {
+				Vector2(-bc.y(),  bc.x()),
+				Vector2( ac.y(), -ac.x()),
+				Vector2(-ab.y(),  ab.x())
+			};
+
+			real sqnorm = 0.;
+			for (int k = 0; k < 3; k++) {
+				if (get_if<int>(&vertices[f[k]])) {
+					sqnorm += darea[k].squaredNorm();
 				}
+			}
+			if (sqnorm == 0.) {
+				// all corners fixed (or collapsed onto one point), nothing to move
+				continue;
+			}
+			changed = true;
 
-				real fac = constraint / sqnorm;
-
-				if (const int *ix = get_if<int>(&vertices[face->vertex(0)->info()])) {
-					x.segment<2>(2**ix) += fac * darea_da;
-				}
-				if (const int *ix = get_if<int>(&vertices[face->vertex(1)->info()])) {
-					x.segment<2>(2**ix) += fac * darea_db;
-				}
-				if (const int *ix = get_if<int>(&vertices[face->vertex(2)->info()])) {
-					x.segment<2>(2**ix) += fac * darea_dc;
+			// step along the area gradient until the linearized area reaches the margin
+			real fac = -constraint / sqnorm;
+			for (int k = 0; k < 3; k++) {
+				if (const int *ix = get_if<int>(&vertices[f[k]])) {
+					x.segment<2>(2**ix) += fac * darea[k];
 				}
 			}
 		}
-	} while(changed);
+
+		if (!changed) {
+			return true;
+		}
+	}
+	return false;
 }
 
 }
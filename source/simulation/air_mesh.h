@@ -20,22 +20,102 @@ typedef CGAL::Constrained_Delaunay_triangulation_2<K,TriangulationDataStructure>
 
 class AirMesh {
 public:
+	// a SimulationMesh::Vertex, which can't be forward declared
+	using MeshVertex = std::variant<Vector2, int>;
+	// listref<SimulationMesh::Vertex>::id(), stays unique when slots are reused
+	using VertexId = uint64_t;
+
 	CDT cdt;
-	vector<std::variant<Vector2, int>> vertices;
+	vector<MeshVertex> vertices;
+
+	// changes whenever the triangulation does
+	long version = next_version();
+
+	// relax() only looks at vertices that moved further than this since they
+	// were last looked at
+	real relax_threshold = 1e-3;
+	// every this many calls relax() looks at all edges anyway, in case the
+	// vertices of a face drift apart while each one stays below the threshold
+	int full_relax_interval = 50;
+
+	// doubled triangle area below which barrier() becomes active
+	real barrier_area = 1e-3;
+
+	// sweeps over all triangles before project() gives up
+	int max_project_passes = 100;
 
 	AirMesh();
 	AirMesh(SimulationMesh &mesh);
+	AirMesh(const AirMesh &other);
+	AirMesh &operator=(const AirMesh &other);
 
 
 	void clear();
 	bool empty() const;
 
+	/// Flips unconstrained edges to improve the worst triangle quality.
+	/// Starts from the edges around vertices that moved, or from all edges
+	/// after the triangulation changed.
 	bool relax(const VectorX &x);
 
+	/// Incremental updates following the edits of the simulation mesh, called
+	/// by SimulationMesh. They return false if the air mesh can't follow, in
+	/// which case it has to be cleared and regenerated.
+	/// center was just inserted halfway along the segment (start, end)
+	bool split(SimulationMesh &mesh, VertexId start, VertexId end, VertexId center);
+	bool insert(SimulationMesh &mesh, VertexId v);
+	bool insert_constraint(SimulationMesh &mesh, VertexId a, VertexId b);
+	/// Must be called by SimulationMesh::cleanup() before it renumbers anything
+	bool cleanup(SimulationMesh &mesh, const vector<int> &newindex);
+
 	real penalty(real k, const VectorX &x, VectorX *grad) const;
+	void hessian(real k, const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project) const;
+	/// Log barrier on the triangle areas, an alternative to penalty() that
+	/// keeps x inversion free. Infinite if any triangle is inverted.
 	real barrier(real k, const VectorX &x, VectorX *grad) const;
+	void barrier_hessian(real k, const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project) const;
+	/// Largest t such that no triangle collapses on the way from x to x + t*dir,
+	/// infinity if none ever does and 0 if x is not inversion free
+	real max_feasible_step(const VectorX &x, const VectorX &dir) const;
+
+	/// Pushes the corners of triangles below the minimum area outwards,
+	/// for at most max_project_passes sweeps. Returns false if some movable
+	/// triangle is still too small after that.
+	bool project(VectorX &x) const;
+
+	// finite faces as indices into vertices, rebuilt whenever the version changes
+	const vector<array<int, 3>> &faces() const;
+
+private:
+	// CDT vertex of every simulation vertex, by slot index together with the
+	// id of the vertex it belongs to. Handles don't survive a copy, so copies
+	// rebuild this from the vertex order on first use.
+	struct Handle {
+		VertexId id = 0;
+		CDT::Vertex_handle vertex;
+	};
+	vector<Handle> handles;
+	// CDT vertices of erased simulation vertices whose slot was reused
+	// before cleanup() could remove them
+	vector<CDT::Vertex_handle> orphans;
+	bool handles_valid = false;
+	bool update_handles(SimulationMesh &mesh);
+	// null handle if the vertex is unknown
+	CDT::Vertex_handle handle(VertexId id) const;
+	void set_handle(VertexId id, CDT::Vertex_handle vertex);
+	// moves the CDT points to x, false if the triangulation is no longer embedded there
+	bool move_points(const VectorX &x);
+
+	// state of the last relax(), the positions are updated per vertex
+	long relaxed_version = -1;
+	int relaxes_since_full = 0;
+	// position of each vertex when it last seeded the worklist. Moves are
+	// measured from there, so small ones add up until they cross the threshold.
+	VectorX seeded_x;
+	vector<CDT::Vertex_handle> dof_vertices;
 
-	void project(VectorX &x) const;
+	mutable vector<array<int, 3>> face_cache;
+	mutable long face_cache_version = -1;
 };
 
 }
@@ -0,0 +1,186 @@
+#include "simulation/coarse_mesh.h"
+
+namespace ruffles::simulation {
+
+using Vertex = SimulationMesh::Vertex;
+using Segment = SimulationMesh::Segment;
+
+CoarseMesh::CoarseMesh(SimulationMesh &fine, const vector<Chain> &fine_chains, int factor) {
+	mesh.k_global = fine.k_global;
+	mesh.k_bend = fine.k_bend;
+	mesh.density = fine.density;
+	mesh.lambda_membrane = fine.lambda_membrane;
+	mesh.lambda_air_mesh = fine.lambda_air_mesh;
+	mesh.use_barrier = fine.use_barrier;
+	mesh.gravity = fine.gravity;
+	mesh.lb = fine.lb;
+	mesh.ub = fine.ub;
+
+	// fine vertices and segments by index()
+	vector<int> n_segments(fine.vertices.capacity(), 0);
+	for (auto &seg : fine.segments) {
+		n_segments[seg.start.index()]++;
+		n_segments[seg.end.index()]++;
+	}
+
+	// drop interior vertices of each chain, except every factor-th one
+	vector<bool> dropped(fine.vertices.capacity(), false);
+	for (auto &chain : fine_chains) {
+		int n = chain.size();
+		int groups = max(1, n / max(1, factor));
+		for (int k = 1; k < n; k++) {
+			listref<Vertex> v = chain[k]->start;
+			bool boundary = (long)k * groups / n != (long)(k-1) * groups / n;
+			bool contiguous = chain[k-1]->end == chain[k]->start;
+			if (!boundary && contiguous && n_segments[v.index()] == 2 && !v->fixed()) {
+				dropped[v.index()] = true;
+			}
+		}
+	}
+
+	vector<listref<Vertex>> kept(fine.vertices.capacity());
+	for (auto it = fine.vertices.begin(); it != fine.vertices.end(); ++it) {
+		if (dropped[it.index()]) {
+			continue;
+		}
+		listref<Vertex> v = mesh.push_vertex(fine.get_vertex_position(*it), it->fixed());
+		v->width = it->width;
+		v->z = it->z;
+		kept[it.index()] = v;
+		if (const int *ix = get_if<int>(&*it)) {
+			interpolation.push_back({*ix, v, v, v, v, 0.});
+		}
+	}
+
+	// split extra masses and forces of dropped vertices onto the coarse segment ends
+	vector<tuple<listref<Vertex>, listref<Vertex>, real>> dropped_at(fine.vertices.capacity());
+
+	// default constructed for segments that are in no chain
+	vector<listref<Segment>> coarse_segment(fine.segments.capacity());
+	size_t first_interpolation = interpolation.size();
+	for (auto &chain : fine_chains) {
+		Chain coarse_chain;
+		size_t first = 0;
+		real length = 0.;
+		for (size_t k = 0; k < chain.size(); k++) {
+			length += chain[k]->length;
+			bool last = k+1 == chain.size() || !dropped[chain[k]->end.index()];
+			if (!last) {
+				continue;
+			}
+			listref<Vertex> a = kept[chain[first]->start.index()];
+			listref<Vertex> b = kept[chain[k]->end.index()];
+			listref<Segment> seg = mesh.push_segment(a, b, length);
+			coarse_chain.push_back(seg);
+
+			real along = 0.;
+			for (size_t j = first; j <= k; j++) {
+				if (coarse_segment[chain[j].index()] == listref<Segment>()) {
+					coarse_segment[chain[j].index()] = seg;
+				}
+				along += chain[j]->length;
+				if (j < k) {
+					listref<Vertex> v = chain[j]->end;
+					if (std::get<0>(dropped_at[v.index()]) == listref<Vertex>()) {
+						dropped_at[v.index()] = tuple(a, b, along / length);
+					}
+					if (const int *ix = get_if<int>(&*v)) {
+						interpolation.push_back({*ix, a, b, a, b, along / length});
+					}
+				}
+			}
+			first = k+1;
+			length = 0.;
+		}
+		chains.push_back(coarse_chain);
+	}
+
+	// tangents from the neighbouring coarse segments of the same chain
+	// coarse vertices by index(), default constructed at the ends of a chain
+	vector<listref<Vertex>> before(mesh.vertices.capacity()), after(mesh.vertices.capacity());
+	for (auto &chain : chains) {
+		for (size_t k = 1; k < chain.size(); k++) {
+			if (chain[k-1]->end == chain[k]->start) {
+				if (after[chain[k-1]->end.index()] == listref<Vertex>()) {
+					after[chain[k-1]->end.index()] = chain[k]->end;
+				}
+				if (before[chain[k]->start.index()] == listref<Vertex>()) {
+					before[chain[k]->start.index()] = chain[k-1]->start;
+				}
+			}
+		}
+	}
+	for (size_t i = first_interpolation; i < interpolation.size(); i++) {
+		auto &interp = interpolation[i];
+		if (before[interp.a.index()] != listref<Vertex>()) {
+			interp.before = before[interp.a.index()];
+		}
+		if (after[interp.b.index()] != listref<Vertex>()) {
+			interp.after = after[interp.b.index()];
+		}
+	}
+
+	// segments that belong to no chain are kept as they are
+	for (auto seg = fine.segments.begin(); seg != fine.segments.end(); ++seg) {
+		if (coarse_segment[seg.index()] == listref<Segment>()) {
+			coarse_segment[seg.index()] = mesh.push_segment(kept[seg->start.index()], kept[seg->end.index()], seg->length);
+		}
+	}
+
+	for (auto &[a, b] : fine.connection_bends) {
+		mesh.connection_bends.push_back({coarse_segment[a.index()], coarse_segment[b.index()]});
+	}
+	mesh.invalidate_topology();
+
+	auto distribute = [&](listref<Vertex> v, auto value, auto &target) {
+		if (!dropped[v.index()]) {
+			target.emplace_back(kept[v.index()], value);
+		} else {
+			auto [a, b, t] = dropped_at[v.index()];
+			target.emplace_back(a, (1-t) * value);
+			target.emplace_back(b, t * value);
+		}
+	};
+	for (auto &[v, m] : fine.extra_mass) {
+		distribute(v, m, mesh.extra_mass);
+	}
+	for (auto &[v, f] : fine.external_forces) {
+		distribute(v, f, mesh.external_forces);
+	}
+	mesh.update_vertex_mass();
+
+	if (!fine.air_mesh.empty()) {
+		try {
+			mesh.generate_air_mesh();
+		} catch (std::exception &e) {
+			// merged segments may cross other parts of the strip
+			valid = false;
+		}
+	}
+}
+
+void CoarseMesh::prolongate(SimulationMesh &fine) const {
+	for (auto &[index, a, b, before, after, t] : interpolation) {
+		Vector2 pa = mesh.get_vertex_position(*a);
+		Vector2 pb = mesh.get_vertex_position(*b);
+		real length = (pb - pa).norm();
+
+		// Catmull-Rom like tangents of the same length as the segment
+		auto tangent = [&](Vector2 from, Vector2 to) -> Vector2 {
+			Vector2 d = to - from;
+			real n = d.norm();
+			return n > 0. ? Vector2(length / n * d) : Vector2(pb - pa);
+		};
+		Vector2 ta = tangent(mesh.get_vertex_position(*before), pb);
+		Vector2 tb = tangent(pa, mesh.get_vertex_position(*after));
+
+		real t2 = t*t, t3 = t2*t;
+		fine.x.segment<2>(2*index) =
+			  (2*t3 - 3*t2 + 1) * pa
+			+ (t3 - 2*t2 + t)   * ta
+			+ (-2*t3 + 3*t2)    * pb
+			+ (t3 - t2)         * tb;
+	}
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common/common.h"
+
+#include "simulation/simulation_mesh.h"
+
+namespace ruffles::simulation {
+
+/// Coarser copy of a SimulationMesh for multiresolution solves. Consecutive
+/// segments of each chain (a section of the ruffle) are merged into one
+/// segment of their total length. Fixed vertices, vertices that end a chain
+/// and vertices shared with other segments are always kept.
+class CoarseMesh {
+public:
+	using Chain = vector<listref<SimulationMesh::Segment>>;
+
+	/// merges about factor segments of every chain, the fine mesh must outlive this
+	CoarseMesh(SimulationMesh &fine, const vector<Chain> &chains, int factor);
+
+	/// Moves the movable vertices of the fine mesh to the coarse solution.
+	/// Dropped vertices are placed on a cubic Hermite curve along their coarse
+	/// segment, so the turning angle is spread instead of concentrated on the
+	/// kept vertices.
+	void prolongate(SimulationMesh &fine) const;
+
+	SimulationMesh mesh;
+	vector<Chain> chains; // the chains in terms of coarse segments
+
+	// false if no air mesh could be built although the fine mesh has one
+	bool valid = true;
+
+private:
+	struct Interpolation {
+		int index; // into fine x, divided by two
+		listref<SimulationMesh::Vertex> a, b;
+		// neighbours of a and b along the chain for the tangents, a or b at chain ends
+		listref<SimulationMesh::Vertex> before, after;
+		real t;
+	};
+	vector<Interpolation> interpolation;
+};
+
+}
@@ -1,20 +1,27 @@
 #include "simulation/combination.h"
 
+#include "common/imgui.h"
+
 namespace ruffles::simulation {
 
 Combination::Combination(const SimulationMesh &mesh)
-	: lbfgs(mesh), verlet(mesh) {
+	: lbfgs(mesh), verlet(mesh), fire(mesh) {
 }
 
 void Combination::reset(const SimulationMesh &mesh) {
 	lbfgs_converged = false;
 	lbfgs.reset(mesh);
 	verlet.reset(mesh);
+	fire.reset(mesh);
 }
 
 bool Combination::step(SimulationMesh &mesh) {
 	if (lbfgs_converged) {
-		return verlet.step(mesh);
+		switch (second_stage) {
+			case SecondStage::Verlet: return verlet.step(mesh);
+			case SecondStage::FIRE: return fire.step(mesh);
+		}
+		return true;
 	} else {
 		lbfgs_converged = lbfgs.step(mesh);
 		if (lbfgs_converged) {
@@ -24,7 +31,20 @@ bool Combination::step(SimulationMesh &mesh) {
 	}
 }
 
+std::unique_ptr<Simulator> Combination::clone() const {
+	return std::make_unique<Combination>(*this);
+}
+
 void Combination::menu_callback() {
+	int choice = static_cast<int>(second_stage);
+	const char *stages[] = {"Verlet", "FIRE"};
+	if (ImGui::Combo("Second stage", &choice, stages, IM_ARRAYSIZE(stages))) {
+		second_stage = static_cast<SecondStage>(choice);
+	}
+	switch (second_stage) {
+		case SecondStage::Verlet: verlet.menu_callback(); break;
+		case SecondStage::FIRE: fire.menu_callback(); break;
+	}
 }
 
 }
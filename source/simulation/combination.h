@@ -5,6 +5,7 @@
 
 #include "simulation/lbfgs.h"
 #include "simulation/verlet.h"
+#include "simulation/fire.h"
 
 namespace ruffles::simulation {
 
@@ -13,6 +14,14 @@ public:
 	LBFGS lbfgs;
 	bool lbfgs_converged = false;
 	Verlet verlet;
+	FIRE fire;
+
+	// dynamics taking over after LBFGS converged
+	enum class SecondStage {
+		Verlet,
+		FIRE,
+	};
+	SecondStage second_stage = SecondStage::Verlet;
 
 	Combination(const SimulationMesh &mesh);
 
@@ -21,6 +30,8 @@ public:
 	virtual bool step(SimulationMesh &mesh) override;
 
 	virtual void menu_callback() override;
+
+	virtual std::unique_ptr<Simulator> clone() const override;
 };
 
 }
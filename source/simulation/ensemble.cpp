@@ -0,0 +1,418 @@
+#include "simulation/ensemble.h"
+#include "common/thread_pool.h"
+
+namespace ruffles::simulation {
+
+using ArrayX = Ensemble::ArrayX;
+using ArrayXX = Ensemble::ArrayXX;
+using ArrayXb = Ensemble::ArrayXb;
+
+// Per lane reductions and updates, column by column in fixed size pieces of
+// angle_batch_size lanes, so every operation is a vector over the lanes.
+// The number of lanes is always a multiple of angle_batch_size.
+static ArrayX lane_dot(const ArrayXX &a, const ArrayXX &b) {
+	constexpr int n = angle_batch_size;
+	ArrayX res(a.rows());
+	for (int first = 0; first < a.rows(); first += n) {
+		AngleBatch sum = AngleBatch::Zero();
+		for (int i = 0; i < a.cols(); i++) {
+			sum += a.col(i).segment<n>(first) * b.col(i).segment<n>(first);
+		}
+		res.segment<n>(first) = sum;
+	}
+	return res;
+}
+
+static ArrayX lane_max_abs(const ArrayXX &a) {
+	constexpr int n = angle_batch_size;
+	ArrayX res(a.rows());
+	for (int first = 0; first < a.rows(); first += n) {
+		AngleBatch max = AngleBatch::Zero();
+		for (int i = 0; i < a.cols(); i++) {
+			max = max.max(a.col(i).segment<n>(first).abs());
+		}
+		res.segment<n>(first) = max;
+	}
+	return res;
+}
+
+// a += f * b with one factor per lane
+static void lane_axpy(ArrayXX &a, const ArrayX &f, const ArrayXX &b) {
+	constexpr int n = angle_batch_size;
+	for (int first = 0; first < a.rows(); first += n) {
+		AngleBatch factor = f.segment<n>(first);
+		for (int i = 0; i < a.cols(); i++) {
+			a.col(i).segment<n>(first) += factor * b.col(i).segment<n>(first);
+		}
+	}
+}
+
+Ensemble::Ensemble(const vector<SimulationMesh *> &members_, LBFGSpp::LBFGSBParam<real> param) :
+	param(param),
+	members(members_)
+{
+	assert(!members.empty());
+	const SimulationMesh::Compiled &c0 = members.front()->compiled();
+	n_free = c0.n_free;
+	n_slots = c0.n_slots;
+	bends = c0.bends;
+	segments = c0.segments;
+	n_lanes = (members.size() + angle_batch_size-1) / angle_batch_size * angle_batch_size;
+
+	const int n_bends = bends.size();
+	const int n_segments = segments.size();
+	bend_k.resize(n_lanes, n_bends);
+	length.resize(n_lanes, n_segments);
+	membrane_k.resize(n_lanes);
+	linear = ArrayXX::Zero(n_lanes, 2*n_slots);
+	fixed.resize(n_lanes, 2*(n_slots - n_free));
+	lb.resize(n_lanes, 2*n_free);
+	ub.resize(n_lanes, 2*n_free);
+	x.resize(n_lanes, 2*n_free);
+	done = ArrayXb::Zero(n_lanes);
+
+	for (int lane = 0; lane < n_lanes; lane++) {
+		// padding lanes repeat the first member and are never stepped
+		int member = lane < size() ? lane : 0;
+		const SimulationMesh &mesh = *members[member];
+		const SimulationMesh::Compiled &c = mesh.compiled();
+		assert(same_topology(mesh, *members.front()));
+		any_barrier = any_barrier || mesh.use_barrier;
+
+		for (int i = 0; i < n_bends; i++) {
+			int b = bends[i][1];
+			real avg_length = 0.5*(c.length(c.bend_segments[i][0]) + c.length(c.bend_segments[i][1]));
+			bend_k(lane, i) = mesh.k_global*mesh.k_bend*c.width(b)/avg_length;
+		}
+		length.row(lane) = c.length.transpose().array();
+		membrane_k(lane) = mesh.k_global*mesh.lambda_membrane;
+
+		for (int slot = 0; slot < n_slots; slot++) {
+			linear.row(lane).segment<2>(2*slot) += mesh.k_global*c.mass(slot)*mesh.gravity.transpose().array();
+		}
+		for (auto &[v, m] : c.extra_mass) {
+			linear.row(lane).segment<2>(2*v) += mesh.k_global*m*mesh.gravity.transpose().array();
+		}
+		for (auto &[v, f] : c.external_forces) {
+			linear.row(lane).segment<2>(2*v) += mesh.k_global*f.transpose().array();
+		}
+		fixed.row(lane) = Eigen::Map<const VectorX>(c.fixed_positions.data(), fixed.cols()).transpose().array();
+
+		lb.row(lane) = mesh.lb.replicate(n_free, 1).transpose().array();
+		ub.row(lane) = mesh.ub.replicate(n_free, 1).transpose().array();
+		x.row(lane) = mesh.x.transpose().array();
+		done(lane) = lane >= size();
+	}
+
+	s_history.assign(param.m, ArrayXX::Zero(n_lanes, 2*n_free));
+	y_history.assign(param.m, ArrayXX::Zero(n_lanes, 2*n_free));
+	rho = ArrayXX::Zero(n_lanes, param.m);
+	gamma = ArrayX::Ones(n_lanes);
+}
+
+bool Ensemble::same_topology(const SimulationMesh &a, const SimulationMesh &b) {
+	const SimulationMesh::Compiled &ca = a.compiled();
+	const SimulationMesh::Compiled &cb = b.compiled();
+	return ca.n_free == cb.n_free
+		&& ca.n_slots == cb.n_slots
+		&& ca.bends == cb.bends
+		&& ca.bend_segments == cb.bend_segments
+		&& ca.segments == cb.segments;
+}
+
+int Ensemble::size() const {
+	return members.size();
+}
+
+bool Ensemble::converged(int member) const {
+	return done(member);
+}
+
+void Ensemble::load(int member) {
+	x.row(member) = members[member]->x.transpose().array();
+}
+
+void Ensemble::store(int member) {
+	members[member]->x = x.row(member).transpose().matrix();
+}
+
+
+void Ensemble::energy(const ArrayXX &x, ArrayX &res, ArrayXX *grad, const ArrayXb *mask) const {
+	assert(x.rows() == n_lanes && x.cols() == 2*n_free);
+
+	ArrayXX pos(n_lanes, 2*n_slots);
+	pos.leftCols(2*n_free) = x;
+	pos.rightCols(fixed.cols()) = fixed;
+
+	ArrayXX g;
+	if (grad) {
+		g.setZero(n_lanes, 2*n_slots);
+	}
+	res.setZero(n_lanes);
+
+	// blocks of lanes touch disjoint rows, no reduction needed
+	int n_blocks = n_lanes / angle_batch_size;
+	auto run = [&](int, int begin, int end) {
+		for (int block = begin; block < end; block++) {
+			if (mask && !mask->segment<angle_batch_size>(block*angle_batch_size).any()) {
+				continue;
+			}
+			elastic_energy(pos, block*angle_batch_size, res, grad ? &g : nullptr);
+		}
+	};
+	if (n_blocks > 1) {
+		ThreadPool::global().parallel_for(n_blocks, run);
+	} else {
+		run(0, 0, n_blocks);
+	}
+
+	// gravity, extra masses and external forces
+	res -= lane_dot(linear, pos);
+	if (grad) {
+		g -= linear;
+		*grad = g.leftCols(2*n_free);
+	}
+
+	// the air mesh differs from member to member
+	VectorX xm, gm;
+	for (int m = 0; m < size(); m++) {
+		if (mask && !(*mask)(m)) {
+			continue;
+		}
+		const SimulationMesh &mesh = *members[m];
+		xm = x.row(m).transpose().matrix();
+		if (grad) {
+			gm.setZero(xm.size());
+		}
+		real k = mesh.k_global * mesh.lambda_air_mesh;
+		if (mesh.use_barrier) {
+			res(m) += mesh.air_mesh.barrier(k, xm, grad ? &gm : nullptr);
+		} else {
+			res(m) += mesh.air_mesh.penalty(k, xm, grad ? &gm : nullptr);
+		}
+		if (grad) {
+			grad->row(m) += gm.transpose().array();
+		}
+	}
+}
+
+void Ensemble::elastic_energy(const ArrayXX &pos, int first, ArrayX &res, ArrayXX *g) const {
+	constexpr int n = angle_batch_size;
+	AngleBatch e = AngleBatch::Zero();
+
+	// bending energy, one corner of n members at a time
+	array<AngleBatch, 6> corners, grad_theta;
+	for (int i = 0; i < (int)bends.size(); i++) {
+		const array<int, 3> &corner = bends[i];
+		for (int j = 0; j < 3; j++) {
+			for (int k = 0; k < 2; k++) {
+				corners[2*j+k] = pos.col(2*corner[j]+k).segment<n>(first);
+			}
+		}
+		AngleBatch theta = angle_batch(corners, g ? &grad_theta : nullptr);
+		AngleBatch stiffness = bend_k.col(i).segment<n>(first);
+		AngleBatch d = theta - M_PI;
+		e += stiffness * d * d;
+		if (g) {
+			AngleBatch fac = 2*stiffness*d;
+			for (int j = 0; j < 3; j++) {
+				for (int k = 0; k < 2; k++) {
+					g->col(2*corner[j]+k).segment<n>(first) += fac * grad_theta[2*j+k];
+				}
+			}
+		}
+	}
+
+	// membrane energy
+	AngleBatch k_membrane = membrane_k.segment<n>(first);
+	for (int i = 0; i < (int)segments.size(); i++) {
+		auto [s, t] = segments[i];
+		AngleBatch dx = pos.col(2*t+0).segment<n>(first) - pos.col(2*s+0).segment<n>(first);
+		AngleBatch dy = pos.col(2*t+1).segment<n>(first) - pos.col(2*s+1).segment<n>(first);
+		AngleBatch h = (dx*dx + dy*dy).sqrt();
+		AngleBatch dh = h - length.col(i).segment<n>(first);
+		e += k_membrane * dh * dh;
+		if (g) {
+			AngleBatch fac = 2*k_membrane*dh/h;
+			g->col(2*s+0).segment<n>(first) -= fac*dx;
+			g->col(2*s+1).segment<n>(first) -= fac*dy;
+			g->col(2*t+0).segment<n>(first) += fac*dx;
+			g->col(2*t+1).segment<n>(first) += fac*dy;
+		}
+	}
+
+	res.segment<n>(first) += e;
+}
+
+void Ensemble::clear_history(int lane) {
+	rho.row(lane).setZero();
+	gamma(lane) = 1.;
+}
+
+void Ensemble::two_loop(const ArrayXX &grad, const ArrayXX &free, const ArrayXb &use_history, ArrayXX &dir) const {
+	// dir = -H grad restricted to the free variables, for every lane at once
+	dir = -grad * free;
+
+	auto index = [&](int k) { return (history_start + k) % param.m; };
+	ArrayXX alpha(n_lanes, history_size);
+	for (int k = history_size-1; k >= 0; k--) {
+		int j = index(k);
+		alpha.col(k) = use_history.select(rho.col(j), 0.) * lane_dot(s_history[j], dir);
+		lane_axpy(dir, -alpha.col(k), y_history[j]);
+	}
+	dir.colwise() *= use_history.select(gamma, 1.);
+	for (int k = 0; k < history_size; k++) {
+		int j = index(k);
+		ArrayX beta = use_history.select(rho.col(j), 0.) * lane_dot(y_history[j], dir);
+		lane_axpy(dir, alpha.col(k) - beta, s_history[j]);
+	}
+	dir *= free;
+}
+
+bool Ensemble::step() {
+	const int max_iterations = param.max_iterations > 0 ? param.max_iterations : 1000;
+
+	if (any_barrier) {
+		for (int m = 0; m < size(); m++) {
+			if (!done(m) && members[m]->make_feasible()) {
+				load(m);
+			}
+		}
+	}
+
+	ArrayX e, new_e, trial_e;
+	ArrayXX grad, new_grad, trial_grad, dir, new_x, trial_x, free, descent;
+	ArrayXb active = !done;
+	energy(x, e, &grad, &active);
+
+	ArrayXb skip_history = ArrayXb::Zero(n_lanes);
+	ArrayXb history_failed = ArrayXb::Zero(n_lanes);
+	for (int it = 0; it < max_iterations; it++) {
+		// variables at a bound whose gradient points outside are kept fixed
+		free = ((x > lb || grad <= 0.) && (x < ub || grad >= 0.)).cast<real>();
+		ArrayX projected_grad = lane_max_abs(x - (x - grad).max(lb).min(ub));
+		ArrayX x_norm = lane_dot(x, x).sqrt();
+		done = done || projected_grad <= param.epsilon * x_norm.max(1.);
+		if (done.all()) {
+			break;
+		}
+		ArrayXb has_history = (rho != 0.).rowwise().any();
+		ArrayXb used_history = !skip_history && has_history;
+		two_loop(grad, free, used_history, dir);
+
+		// no usable curvature information, scaled steepest descent
+		ArrayXb fallback = !used_history || lane_dot(dir, grad) >= 0.;
+		descent = -grad * free;
+		descent.colwise() /= lane_dot(descent, descent).sqrt().max(1.);
+		for (int lane = 0; lane < n_lanes; lane++) {
+			if (done(lane)) {
+				dir.row(lane).setZero();
+			} else if (fallback(lane)) {
+				dir.row(lane) = descent.row(lane);
+			}
+		}
+		used_history = used_history && !fallback;
+		skip_history.setZero();
+
+		// backtracking on the projection onto the box, lanes accept independently
+		ArrayX alpha = ArrayX::Ones(n_lanes);
+		ArrayXb pending = !done;
+		ArrayXb accepted = ArrayXb::Zero(n_lanes);
+		new_x = x;
+		new_e = e;
+		new_grad = grad;
+		for (int ls = 0; ls < param.max_linesearch && pending.any(); ls++) {
+			trial_x = (x + dir.colwise() * alpha).max(lb).min(ub);
+			if (any_barrier) {
+				for (int m = 0; m < size(); m++) {
+					if (pending(m)) {
+						VectorX xm = x.row(m).transpose().matrix();
+						VectorX new_xm = trial_x.row(m).transpose().matrix();
+						members[m]->clamp_to_feasible(xm, new_xm);
+						trial_x.row(m) = new_xm.transpose().array();
+					}
+				}
+			}
+			energy(trial_x, trial_e, &trial_grad, &pending);
+			ArrayX decrease = lane_dot(trial_x - x, grad);
+			ArrayXb ok = pending && trial_e.isFinite() && trial_e <= e + param.ftol * decrease;
+			for (int lane = 0; lane < n_lanes; lane++) {
+				if (ok(lane)) {
+					new_x.row(lane) = trial_x.row(lane);
+					new_grad.row(lane) = trial_grad.row(lane);
+					new_e(lane) = trial_e(lane);
+				}
+			}
+			accepted = accepted || ok;
+			pending = pending && !ok;
+			alpha = pending.select(0.5*alpha, alpha);
+		}
+		iterations++;
+
+		for (int lane = 0; lane < n_lanes; lane++) {
+			if (done(lane)) {
+				continue;
+			}
+			if (!accepted(lane)) {
+				if (used_history(lane)) {
+					// try again without the history
+					skip_history(lane) = true;
+					history_failed(lane) = true;
+				} else {
+					// no progress possible along the gradient either
+					done(lane) = true;
+				}
+			} else if (history_failed(lane)) {
+				// steepest descent worked where the history did not, it is stale
+				clear_history(lane);
+				history_failed(lane) = false;
+			}
+		}
+
+		// the new pair goes into the same slot for every lane, lanes without
+		// a step or with too little curvature get rho 0 there
+		ArrayXX s = new_x - x;
+		ArrayXX y = new_grad - grad;
+		ArrayX sy = lane_dot(s, y);
+		ArrayX yy = lane_dot(y, y);
+		ArrayXb valid = accepted && sy > std::numeric_limits<real>::epsilon() * yy;
+		int j = (history_start + history_size) % param.m;
+		if (history_size < param.m) {
+			history_size++;
+		} else {
+			history_start = (history_start + 1) % param.m;
+		}
+		s_history[j] = s;
+		y_history[j] = y;
+		rho.col(j) = valid.select(1. / sy, 0.);
+		gamma = valid.select(sy / yy, gamma);
+
+		x.swap(new_x);
+		grad.swap(new_grad);
+		e.swap(new_e);
+	}
+
+	bool all_converged = true;
+	for (int m = 0; m < size(); m++) {
+		store(m);
+		if (members[m]->relax_air_mesh()) {
+			// air mesh changed, run this member again with the same history
+			done(m) = false;
+		}
+		all_converged = all_converged && done(m);
+	}
+	return all_converged;
+}
+
+int Ensemble::solve(int max_steps) {
+	int steps = 0;
+	while (steps < max_steps) {
+		steps++;
+		if (step()) {
+			break;
+		}
+	}
+	return steps;
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common/common.h"
+
+#include "simulation/simulation_mesh.h"
+
+#include <LBFGSB.h>
+
+namespace ruffles::simulation {
+
+/// Projected L-BFGS on several meshes of identical topology at once, like the
+/// clones of one Ruffle with different section lengths in a ParticleSwarm.
+/// Positions are stored DOF-major and member-minor: column i of an ArrayXX
+/// holds coordinate i of every member. The bending and membrane terms of all
+/// members are evaluated in one pass over the topology, angle_batch_size
+/// members per vector, only the air mesh term is evaluated member by member.
+/// Every member has its own line search, history and convergence test,
+/// converged members are frozen while the others continue.
+class Ensemble {
+public:
+	using ArrayX = Eigen::Array<real, -1, 1>;
+	using ArrayXX = Eigen::Array<real, -1, -1>;
+	using ArrayXb = Eigen::Array<bool, -1, 1>;
+
+	/// All members must have the same topology, see same_topology(), and keep
+	/// it while the ensemble is in use
+	Ensemble(const vector<SimulationMesh *> &members, LBFGSpp::LBFGSBParam<real> param = LBFGSpp::LBFGSBParam<real>());
+
+	static bool same_topology(const SimulationMesh &a, const SimulationMesh &b);
+
+	/// Energies of all lanes at x (lanes x dof), and their gradients if grad
+	/// is given. Lanes past size() are padding. With a mask, only blocks of
+	/// lanes containing a selected one are evaluated, the results of the other
+	/// lanes are undefined.
+	void energy(const ArrayXX &x, ArrayX &res, ArrayXX *grad, const ArrayXb *mask = nullptr) const;
+
+	/// Up to param.max_iterations iterations on every unconverged member, then
+	/// writes the positions back and relaxes the air meshes. Returns true when
+	/// all members converged.
+	bool step();
+	/// Steps until all members converged, returns the number of steps
+	int solve(int max_steps);
+
+	int size() const;
+	bool converged(int member) const;
+
+	LBFGSpp::LBFGSBParam<real> param;
+	int iterations = 0;
+
+private:
+	void load(int member);
+	void store(int member);
+	void clear_history(int lane);
+	void two_loop(const ArrayXX &grad, const ArrayXX &free, const ArrayXb &use_history, ArrayXX &dir) const;
+	// bending and membrane terms of the angle_batch_size lanes starting at first
+	void elastic_energy(const ArrayXX &pos, int first, ArrayX &res, ArrayXX *g) const;
+
+	vector<SimulationMesh *> members;
+	int n_lanes; // members, rounded up to a multiple of angle_batch_size
+	int n_free, n_slots;
+	bool any_barrier = false;
+
+	// topology shared by all members, see SimulationMesh::Compiled
+	vector<array<int, 3>> bends;
+	vector<array<int, 2>> segments;
+
+	// parameters, one row per lane
+	ArrayXX bend_k; // bending stiffness per bend
+	ArrayXX length; // rest length per segment
+	ArrayX membrane_k;
+	ArrayXX linear; // gravity, extra masses and external forces per coordinate
+	ArrayXX fixed; // positions of the fixed slots
+	ArrayXX lb, ub;
+
+	ArrayXX x;
+	ArrayXb done;
+
+	// circular buffer of the last param.m correction pairs, shared by all
+	// lanes. Lanes without a usable pair for a slot have rho 0 there, which
+	// makes the pair a no-op in the two-loop recursion.
+	vector<ArrayXX> s_history, y_history;
+	ArrayXX rho;
+	ArrayX gamma; // scaling of the newest usable pair
+	int history_start = 0;
+	int history_size = 0;
+};
+
+}
@@ -0,0 +1,127 @@
+#include "simulation/fire.h"
+
+#include "common/imgui.h"
+
+namespace ruffles::simulation {
+
+FIRE::FIRE(const SimulationMesh &mesh) {
+	reset(mesh);
+}
+
+void FIRE::reset(const SimulationMesh &mesh) {
+	vel = VectorX::Zero(mesh.dof());
+	time_step_valid = false;
+	dt = dt_start;
+	alpha = alpha_start;
+	n_positive = 0;
+	iterations = 0;
+}
+
+bool FIRE::step(SimulationMesh &mesh) {
+	const int n = mesh.dof();
+	VectorX &pos = mesh.x;
+	if (vel.size() != n) {
+		// the mesh was refined since reset()
+		vel = VectorX::Zero(n);
+		time_step_valid = false;
+	}
+	if (lb.size() != n || bounds_lb != mesh.lb || bounds_ub != mesh.ub) {
+		lb = mesh.lb.replicate(n/2, 1);
+		ub = mesh.ub.replicate(n/2, 1);
+		bounds_lb = mesh.lb;
+		bounds_ub = mesh.ub;
+	}
+	mesh.make_feasible();
+	// unused entries of x have no mass, keep them from flying off
+	inverse_mass = (mesh.m.array() > 0.).select(mesh.m.cwiseInverse(), 0.);
+	if (automatic_dt && !time_step_valid) {
+		update_time_step(mesh);
+	}
+
+	grad.setZero(n);
+	energy = mesh.energy(pos, &grad);
+
+	// coordinates at a bound only feel the force pulling them back inside
+	auto at_lb = pos.array() <= lb.array();
+	auto at_ub = pos.array() >= ub.array();
+	VectorX force = ((at_lb && grad.array() > 0.) || (at_ub && grad.array() < 0.)).select(0., -grad);
+
+	// converged like Newton, on the projected gradient. The force of a
+	// coordinate resting just off a bound is still the full gradient.
+	VectorX projected_grad = pos - (pos - grad).cwiseMax(lb).cwiseMin(ub);
+	if (projected_grad.norm() <= epsilon * max(1., pos.norm())) {
+		return !mesh.relax_air_mesh();
+	}
+
+	real power = force.dot(vel);
+	if (power > 0.) {
+		n_positive++;
+		if (n_positive > n_delay) {
+			dt = min(dt * f_inc, dt_max);
+			alpha *= f_alpha;
+		}
+	} else {
+		// going uphill, step back half way and start over from rest
+		n_positive = 0;
+		if (iterations >= n_delay) {
+			dt = max(dt * f_dec, dt_min);
+			alpha = alpha_start;
+		}
+		VectorX back = pos - 0.5 * dt * vel;
+		mesh.clamp_to_feasible(pos, back);
+		pos = back;
+		vel.setZero();
+	}
+
+	// semi-implicit Euler, mixing the force direction into the new velocity
+	vel += dt * force.cwiseProduct(inverse_mass);
+	real force_norm = force.norm();
+	if (force_norm > 0.) {
+		vel = (1. - alpha) * vel + (alpha * vel.norm() / force_norm) * force;
+	}
+	VectorX moved = pos + dt * vel;
+	VectorX clamped = moved.cwiseMax(lb).cwiseMin(ub);
+	vel = (clamped.array() != moved.array()).select(0., vel);
+	// like a step uphill, stop where the air mesh would invert
+	VectorX feasible = clamped;
+	mesh.clamp_to_feasible(pos, feasible);
+	if (feasible != clamped) {
+		vel.setZero();
+	}
+	pos = feasible;
+
+	iterations++;
+
+	// converged only once the force vanishes at the start of a step
+	mesh.relax_air_mesh();
+	return false;
+}
+
+void FIRE::update_time_step(const SimulationMesh &mesh) {
+	triplets.clear();
+	mesh.hessian(mesh.x, triplets, true);
+	VectorX row_sum = VectorX::Zero(mesh.dof());
+	for (auto &t : triplets) {
+		row_sum(t.row()) += std::abs(t.value());
+	}
+	real lambda = row_sum.cwiseProduct(inverse_mass).maxCoeff();
+	if (lambda > 0.) {
+		dt_max = 2. / std::sqrt(lambda);
+		automatic_dt_start = 0.1 * dt_max;
+		dt = automatic_dt_start;
+	}
+	time_step_valid = true;
+}
+
+std::unique_ptr<Simulator> FIRE::clone() const {
+	return std::make_unique<FIRE>(*this);
+}
+
+void FIRE::menu_callback() {
+	ImGui::Checkbox("automatic dt", &automatic_dt);
+	ImGui::InputReal("dt max", &dt_max, 1e-6, 1e-5, "%.2e");
+	ImGui::InputReal("epsilon", &epsilon, 1e-6, 1e-4, "%.2e");
+	ImGui::Text("Iterations: %d, dt: %.2e", iterations, dt);
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "simulation/simulator.h"
+#include "common/common.h"
+
+namespace ruffles::simulation {
+
+/// Fast Inertial Relaxation Engine (Bitzek et al. 2006, with the FIRE 2.0
+/// modifications of Guénolé et al. 2020): damped dynamics with accelerations
+/// -grad/m, which steers the velocity towards the force and grows the time
+/// step while the motion goes downhill, and stops dead when it goes uphill.
+/// One iteration per step().
+class FIRE : public Simulator {
+public:
+	FIRE(const SimulationMesh &mesh);
+
+	virtual void reset(const SimulationMesh &mesh);
+
+	virtual bool step(SimulationMesh &mesh) override;
+
+	virtual void menu_callback() override;
+
+	virtual std::unique_ptr<Simulator> clone() const override;
+
+	/// Derive dt_max from the stability limit of the dynamics on every
+	/// reset(), 2/sqrt(λ) with a Gershgorin bound λ on the eigenvalues of
+	/// M^-1 H. FIRE keeps restarting when dt_max is much larger than that.
+	bool automatic_dt = true;
+	real dt_start = 1e-6; // without automatic_dt
+	real dt_max = 1e-4;
+	real dt_min = 1e-10;
+	real alpha_start = 0.1; // initial mixing of the force direction into the velocity
+	real f_alpha = 0.99;
+	real f_inc = 1.1;
+	real f_dec = 0.5;
+	int n_delay = 5; // downhill iterations before dt may grow
+	real epsilon = 1e-5; // relative tolerance on the projected gradient
+
+	real energy = std::numeric_limits<real>::infinity();
+	real dt;
+	real alpha;
+	VectorX vel;
+
+	int iterations = 0;
+
+private:
+	void update_time_step(const SimulationMesh &mesh);
+
+	bool time_step_valid = false;
+	vector<Eigen::Triplet<real>> triplets;
+	VectorX grad;
+	VectorX inverse_mass;
+	VectorX lb, ub;
+	// mesh.lb and mesh.ub that lb and ub were built from
+	Vector2 bounds_lb, bounds_ub;
+	real automatic_dt_start = 0.; // 0.1 dt_max
+	int n_positive = 0;
+};
+
+}
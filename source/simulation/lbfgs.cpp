@@ -1,17 +1,31 @@
 #include "simulation/lbfgs.h"
 
+#include "common/imgui.h"
+
+#include <chrono>
+
 namespace ruffles::simulation {
 
 LBFGS::LBFGS(const SimulationMesh &mesh, LBFGSpp::LBFGSBParam<real> param) :
-	solver((*new LBFGSpp::LBFGSBParam<real>(param)))
+	solver((*new LBFGSpp::LBFGSBParam<real>(param))),
+	param(param)
 {
 	reset(mesh);
 }
 
 void LBFGS::reset(const SimulationMesh &) {
+	if (!warm_start) {
+		clear_history();
+	}
+	iterations = 0;
 }
 
 bool LBFGS::step(SimulationMesh &mesh) {
+	if (warm_start || preconditioner != Preconditioner::None || mesh.use_barrier) {
+		// LBFGSpp's line search can't be kept inversion free
+		return warm_step(mesh);
+	}
+
 	VectorX lb = mesh.lb.replicate(mesh.dof()/2, 1);
 	VectorX ub = mesh.ub.replicate(mesh.dof()/2, 1);
 
@@ -37,6 +51,301 @@ bool LBFGS::step(SimulationMesh &mesh) {
 	}
 }
 
-void LBFGS::menu_callback() {}
+void LBFGS::clear_history() {
+	history.clear();
+}
+
+void LBFGS::update_bounds(const SimulationMesh &mesh) {
+	const int n = mesh.dof();
+	if (lb.size() != n || bounds_lb != mesh.lb || bounds_ub != mesh.ub) {
+		lb = mesh.lb.replicate(n/2, 1);
+		ub = mesh.ub.replicate(n/2, 1);
+		bounds_lb = mesh.lb;
+		bounds_ub = mesh.ub;
+	}
+	if (history_topology_version != mesh.topology_version || history.capacity() != param.m) {
+		// push_vertex or cleanup changed the layout, old pairs are meaningless
+		// even if the number of DOFs happens to be the same
+		history.resize(n, param.m);
+		history_topology_version = mesh.topology_version;
+	}
+}
+
+template<typename Scalar>
+void LBFGSHistory<Scalar>::resize(int n, int m) {
+	s.resize(n, m);
+	y.resize(n, m);
+	rho.resize(m);
+	clear();
+}
+
+template<typename Scalar>
+void LBFGSHistory<Scalar>::clear() {
+	start = 0;
+	size = 0;
+}
+
+template<typename Scalar>
+void LBFGSHistory<Scalar>::add(const Vector &s_k, const Vector &y_k) {
+	Scalar sy = s_k.dot(y_k);
+	if (!(sy > std::numeric_limits<Scalar>::epsilon() * y_k.squaredNorm())) {
+		return;
+	}
+	int j = (start + size) % capacity();
+	if (size < capacity()) {
+		size++;
+	} else {
+		start = (start + 1) % capacity();
+	}
+	s.col(j) = s_k;
+	y.col(j) = y_k;
+	rho(j) = Scalar(1) / sy;
+}
+
+template<typename Scalar>
+void LBFGSHistory<Scalar>::two_loop(const Vector &grad, const VectorXb &active, const Preconditioner &precondition, Vector &dir) const {
+	dir = -grad;
+	for (int i = 0; i < dir.size(); i++) {
+		if (active(i)) dir(i) = Scalar(0);
+	}
+	if (size == 0) {
+		if (precondition) {
+			precondition(dir);
+		}
+		return;
+	}
+
+	auto index = [&](int k) { return (start + k) % capacity(); };
+	Vector alpha(size);
+	for (int k = size-1; k >= 0; k--) {
+		int j = index(k);
+		alpha(k) = rho(j) * s.col(j).dot(dir);
+		dir -= alpha(k) * y.col(j);
+	}
+
+	int newest = index(size-1);
+	if (!precondition) {
+		Scalar gamma = s.col(newest).dot(y.col(newest)) / y.col(newest).squaredNorm();
+		dir *= gamma;
+	} else {
+		// scale the preconditioner like the identity would be scaled
+		Vector py = y.col(newest);
+		precondition(py);
+		Scalar gamma = s.col(newest).dot(y.col(newest)) / y.col(newest).dot(py);
+		precondition(dir);
+		dir *= gamma;
+	}
+
+	for (int k = 0; k < size; k++) {
+		int j = index(k);
+		Scalar beta = rho(j) * y.col(j).dot(dir);
+		dir += (alpha(k) - beta) * s.col(j);
+	}
+	for (int i = 0; i < dir.size(); i++) {
+		if (active(i)) dir(i) = Scalar(0);
+	}
+}
+
+template struct LBFGSHistory<float>;
+template struct LBFGSHistory<double>;
+
+void LBFGS::two_loop(const VectorX &grad, const VectorXb &active, bool use_history, VectorX &dir) {
+	// computes dir = -H grad restricted to the free variables
+	LBFGSHistory<real>::Preconditioner precondition;
+	if (preconditioner != Preconditioner::None) {
+		precondition = [&](VectorX &v) { apply_preconditioner(active, v); };
+	}
+	if (!use_history || history.size == 0) {
+		dir = -grad;
+		for (int i = 0; i < dir.size(); i++) {
+			if (active(i)) dir(i) = 0.;
+		}
+		apply_preconditioner(active, dir);
+		return;
+	}
+	history.two_loop(grad, active, precondition, dir);
+}
+
+void LBFGS::update_preconditioner(const SimulationMesh &mesh) {
+	const int n = mesh.dof();
+	if (preconditioner == Preconditioner::None) {
+		return;
+	}
+
+	triplets.clear();
+	mesh.hessian(mesh.x, triplets, true);
+
+	Matrix<real, 4, -1> blocks = Matrix<real, 4, -1>::Zero(4, n/2);
+	for (auto &t : triplets) {
+		if (t.row()/2 == t.col()/2) {
+			blocks(2*(t.col()%2) + t.row()%2, t.row()/2) += t.value();
+		}
+	}
+	// vertices without any stiffness (e.g. unused slots) must not blow up
+	real floor = 1e-8 * max(1., blocks.cwiseAbs().maxCoeff());
+
+	if (preconditioner == Preconditioner::Jacobi) {
+		inverse_diagonal.resize(n);
+		for (int v = 0; v < n/2; v++) {
+			inverse_diagonal(2*v+0) = 1. / max(floor, blocks(0, v));
+			inverse_diagonal(2*v+1) = 1. / max(floor, blocks(3, v));
+		}
+	} else {
+		inverse_blocks.resize(4, n/2);
+		for (int v = 0; v < n/2; v++) {
+			Matrix2 block = Eigen::Map<Matrix2>(blocks.col(v).data());
+			block += floor * Matrix2::Identity();
+			Eigen::Map<Matrix2>(inverse_blocks.col(v).data()) = block.inverse();
+		}
+		// the diagonal is still used for vertices with one active coordinate
+		inverse_diagonal.resize(n);
+		for (int v = 0; v < n/2; v++) {
+			inverse_diagonal(2*v+0) = 1. / (blocks(0, v) + floor);
+			inverse_diagonal(2*v+1) = 1. / (blocks(3, v) + floor);
+		}
+	}
+}
+
+void LBFGS::apply_preconditioner(const VectorXb &active, VectorX &v) const {
+	switch (preconditioner) {
+		case Preconditioner::None:
+			break;
+		case Preconditioner::Jacobi:
+			v = v.cwiseProduct(inverse_diagonal);
+			break;
+		case Preconditioner::BlockJacobi:
+			for (int i = 0; i < v.size()/2; i++) {
+				if (active(2*i) || active(2*i+1)) {
+					v.segment<2>(2*i) = v.segment<2>(2*i).cwiseProduct(inverse_diagonal.segment<2>(2*i));
+				} else {
+					v.segment<2>(2*i) = Eigen::Map<const Matrix2>(inverse_blocks.col(i).data()) * v.segment<2>(2*i);
+				}
+			}
+			break;
+	}
+	for (int i = 0; i < v.size(); i++) {
+		if (active(i)) v(i) = 0.;
+	}
+}
+
+bool LBFGS::warm_step(SimulationMesh &mesh) {
+	update_bounds(mesh);
+	if (!warm_start) {
+		clear_history();
+	}
+	update_preconditioner(mesh);
+	const int n = mesh.dof();
+	const int max_iterations = param.max_iterations > 0 ? param.max_iterations : 1000;
+
+	mesh.make_feasible();
+	VectorX grad = VectorX::Zero(n);
+	energy = mesh.energy(mesh.x, &grad);
+
+	bool converged = false;
+	bool skip_history = false;
+	bool history_failed = false;
+	VectorXb active(n);
+	VectorX dir, new_x, new_grad(n);
+	for (int it = 0; it < max_iterations; it++) {
+		if (it > 0 && preconditioner_interval > 0 && it % preconditioner_interval == 0) {
+			update_preconditioner(mesh);
+		}
+
+		// variables at a bound whose gradient points outside are kept fixed
+		for (int i = 0; i < n; i++) {
+			active(i) = (mesh.x(i) <= lb(i) && grad(i) > 0.)
+			         || (mesh.x(i) >= ub(i) && grad(i) < 0.);
+		}
+		VectorX projected_grad = mesh.x - (mesh.x - grad).cwiseMax(lb).cwiseMin(ub);
+		if (projected_grad.lpNorm<Eigen::Infinity>() <= param.epsilon * max(1., mesh.x.norm())) {
+			converged = true;
+			break;
+		}
+
+		bool used_history = !skip_history && history.size > 0;
+		two_loop(grad, active, used_history, dir);
+		if (!used_history || dir.dot(grad) >= 0.) {
+			// no usable curvature information, scaled steepest descent
+			used_history = false;
+			two_loop(grad, active, false, dir);
+			if (preconditioner == Preconditioner::None) {
+				dir /= max(1., dir.norm());
+			}
+		}
+		skip_history = false;
+
+		// backtracking on the projection onto the box
+		auto line_search_start = std::chrono::steady_clock::now();
+		real alpha = 1.;
+		bool accepted = false;
+		real new_energy = energy;
+		for (int ls = 0; ls < param.max_linesearch; ls++) {
+			new_x = (mesh.x + alpha * dir).cwiseMax(lb).cwiseMin(ub);
+			mesh.clamp_to_feasible(mesh.x, new_x);
+			new_grad.setZero();
+			new_energy = mesh.energy(new_x, &new_grad);
+			if (std::isfinite(new_energy) && new_energy <= energy + param.ftol * grad.dot(new_x - mesh.x)) {
+				accepted = true;
+				break;
+			}
+			alpha *= 0.5;
+		}
+		mesh.statistics.line_search_time += std::chrono::duration<real>(std::chrono::steady_clock::now() - line_search_start).count();
+		iterations++;
+		if (!accepted) {
+			if (used_history) {
+				// try again without the history
+				skip_history = true;
+				history_failed = true;
+				continue;
+			}
+			// no progress possible along the gradient either, keep the
+			// history for the next solve
+			converged = true;
+			break;
+		}
+		if (history_failed) {
+			// steepest descent worked where the history did not, it is stale
+			clear_history();
+			history_failed = false;
+		}
+
+		history.add(new_x - mesh.x, new_grad - grad);
+
+		mesh.x.swap(new_x);
+		grad.swap(new_grad);
+		energy = new_energy;
+	}
+
+	if (mesh.relax_air_mesh()) {
+		// air mesh changed, run again with the same history
+		return false;
+	}
+	return converged;
+}
+
+std::unique_ptr<Simulator> LBFGS::clone() const {
+	return std::make_unique<LBFGS>(*this);
+}
+
+void LBFGS::menu_callback() {
+	ImGui::Checkbox("warm start", &warm_start);
+
+	int choice = static_cast<int>(preconditioner);
+	const char *preconditioners[] = {"None", "Jacobi", "2x2 block Jacobi"};
+	if (ImGui::Combo("Preconditioner", &choice, preconditioners, IM_ARRAYSIZE(preconditioners))) {
+		preconditioner = static_cast<Preconditioner>(choice);
+	}
+	if (preconditioner != Preconditioner::None) {
+		ImGui::InputInt("update interval", &preconditioner_interval);
+	}
+
+	if (warm_start || preconditioner != Preconditioner::None) {
+		ImGui::Text("Iterations: %d, history: %d", iterations, history.size);
+		if (ImGui::Button("Clear history")) {
+			clear_history();
+		}
+	}
+}
 
 }
@@ -6,8 +6,37 @@
 
 #include <LBFGSB.h>
 
+#include <functional>
+
 namespace ruffles::simulation {
 
+/// Circular buffer of the last m correction pairs (s, y) of a projected
+/// L-BFGS and the two-loop recursion on them. Double precision in LBFGS,
+/// single precision in MixedPrecision.
+template<typename Scalar>
+struct LBFGSHistory {
+	using Vector = Matrix<Scalar, -1, 1>;
+	/// Applies the initial inverse hessian to v and zeroes the active
+	/// entries. Empty for the identity.
+	using Preconditioner = std::function<void(Vector &v)>;
+
+	Matrix<Scalar, -1, -1> s, y;
+	Vector rho;
+	int start = 0;
+	int size = 0;
+
+	/// Room for m pairs of n variables, also clears
+	void resize(int n, int m);
+	void clear();
+	int capacity() const { return s.cols(); }
+	/// Adds the pair of a step, unless s.dot(y) is too small for a
+	/// positive definite update. The oldest pair is dropped when full.
+	void add(const Vector &s_k, const Vector &y_k);
+	/// dir = -H grad restricted to the free variables, with H0 the
+	/// preconditioner scaled like the identity would be
+	void two_loop(const Vector &grad, const VectorXb &active, const Preconditioner &precondition, Vector &dir) const;
+};
+
 class LBFGS : public Simulator {
 public:
 	LBFGS(const SimulationMesh &mesh, LBFGSpp::LBFGSBParam<real> param = LBFGSpp::LBFGSBParam<real>());
@@ -18,8 +47,54 @@ public:
 
 	virtual void menu_callback() override;
 
+	virtual std::unique_ptr<Simulator> clone() const override;
+
 	LBFGSpp::LBFGSBSolver<real> solver;
 	real energy;
+
+	/// Use our own projected L-BFGS instead of LBFGSpp, which keeps its (s, y)
+	/// history across steps, air mesh flips and physics solves, including the
+	/// reset() at the start of each Ruffle::physics_solve. The history is only
+	/// dropped when the mesh topology changes.
+	bool warm_start = false;
+
+	/// Initial inverse hessian of the two-loop recursion, from the diagonal or
+	/// the 2x2 vertex blocks of the hessian at the start of each step. Any
+	/// choice but None also switches to our own L-BFGS, as does
+	/// SimulationMesh::use_barrier.
+	enum class Preconditioner {
+		None,
+		Jacobi,
+		BlockJacobi,
+	};
+	Preconditioner preconditioner = Preconditioner::None;
+	int preconditioner_interval = 50; // iterations between hessian evaluations
+
+	int iterations = 0;
+
+private:
+	bool warm_step(SimulationMesh &mesh);
+	void update_bounds(const SimulationMesh &mesh);
+	void two_loop(const VectorX &grad, const VectorXb &active, bool use_history, VectorX &dir);
+	void update_preconditioner(const SimulationMesh &mesh);
+	void apply_preconditioner(const VectorXb &active, VectorX &v) const;
+	void clear_history();
+
+	LBFGSpp::LBFGSBParam<real> param;
+
+	// replicated mesh.lb/ub, rebuilt when their size or value changes
+	VectorX lb, ub;
+	Vector2 bounds_lb, bounds_ub;
+
+	// the last param.m correction pairs
+	LBFGSHistory<real> history;
+
+	// inverse of the diagonal or of the 2x2 blocks (stored as columns of 4)
+	VectorX inverse_diagonal;
+	Matrix<real, 4, -1> inverse_blocks;
+	vector<Eigen::Triplet<real>> triplets;
+	// SimulationMesh::topology_version the pairs were collected at
+	long history_topology_version = -1;
 };
 
 }
@@ -18,6 +18,7 @@ bool LineSearch::step(SimulationMesh &mesh) {
 		return e;
 	};
 
+	mesh.make_feasible();
 	VectorX dir(mesh.x.size());
 
 	real f0 = f(mesh.x, dir);
@@ -28,6 +29,7 @@ bool LineSearch::step(SimulationMesh &mesh) {
 	int iterations = 0;
 	while (iterations < 100) {
 		VectorX x = mesh.x + step_size * dir;
+		mesh.clamp_to_feasible(mesh.x, x);
 		real f = mesh.energy(x, nullptr);
 		dbg(f);
 		dbg(f0);
@@ -53,6 +55,10 @@ bool LineSearch::step(SimulationMesh &mesh) {
 	}
 }
 
+std::unique_ptr<Simulator> LineSearch::clone() const {
+	return std::make_unique<LineSearch>(*this);
+}
+
 void LineSearch::menu_callback() {}
 
 }
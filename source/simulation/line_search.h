@@ -18,6 +18,8 @@ public:
 
 	virtual void menu_callback() override;
 
+	virtual std::unique_ptr<Simulator> clone() const override;
+
 	real step_size = 0.1;
 };
 
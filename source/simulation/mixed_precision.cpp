@@ -0,0 +1,135 @@
+#include "simulation/mixed_precision.h"
+
+#include "common/imgui.h"
+
+namespace ruffles::simulation {
+
+using Eigen::VectorXf;
+
+static LBFGSpp::LBFGSBParam<real> refinement_param() {
+	LBFGSpp::LBFGSBParam<real> param;
+	param.max_iterations = 20;
+	return param;
+}
+
+MixedPrecision::MixedPrecision(const SimulationMesh &mesh) :
+	refinement(mesh, refinement_param())
+{
+	refinement.warm_start = true;
+	reset(mesh);
+}
+
+void MixedPrecision::reset(const SimulationMesh &mesh) {
+	refinement.reset(mesh);
+	float_converged = false;
+	float_iterations = 0;
+}
+
+bool MixedPrecision::step(SimulationMesh &mesh) {
+	if (!float_converged) {
+		float_converged = float_phase(mesh);
+	}
+	return refinement.step(mesh);
+}
+
+bool MixedPrecision::float_phase(SimulationMesh &mesh) {
+	const int n = mesh.dof();
+	mesh.make_feasible();
+
+	VectorXf x = mesh.x.cast<float>();
+	VectorXf lb = mesh.lb.cast<float>().replicate(n/2, 1);
+	VectorXf ub = mesh.ub.cast<float>().replicate(n/2, 1);
+
+	LBFGSHistory<float> pairs;
+	pairs.resize(n, history);
+
+	// the membrane stiffness puts the Hessian around 1e9, where float
+	// s.dot(y) falls below the curvature threshold of every correction pair
+	// and the iterations degrade to steepest descent. Scaled, it is O(1).
+	const float scale = 1. / (mesh.k_global * mesh.lambda_membrane);
+	auto scaled_energy = [&](const VectorXf &x, VectorXf &grad) {
+		float res = scale * mesh.energy(x, &grad);
+		grad *= scale;
+		return res;
+	};
+
+	VectorXf grad(n), new_grad(n), dir(n), new_x(n);
+	float energy = scaled_energy(x, grad);
+	VectorXb active(n);
+
+	bool converged = false;
+	bool moved = false;
+	for (int it = 0; it < max_float_iterations; it++) {
+		// variables at a bound whose gradient points outside are kept fixed
+		for (int i = 0; i < n; i++) {
+			active(i) = (x(i) <= lb(i) && grad(i) > 0.f)
+			         || (x(i) >= ub(i) && grad(i) < 0.f);
+		}
+
+		// two-loop recursion on the free variables, as in LBFGS
+		pairs.two_loop(grad, active, nullptr, dir);
+		if (pairs.size > 0 && !(dir.dot(grad) < 0.f)) {
+			// not a descent direction, start over from the projected gradient
+			pairs.clear();
+			pairs.two_loop(grad, active, nullptr, dir);
+		}
+		if (pairs.size == 0) {
+			dir /= std::max(1.f, dir.norm());
+		}
+
+		// backtracking on the projection onto the box. A decrease float can't
+		// resolve ends the float iterations, the refinement takes over.
+		float alpha = 1.f;
+		bool accepted = false;
+		float new_energy = energy;
+		for (int ls = 0; ls < 20; ls++) {
+			new_x = (x + alpha * dir).cwiseMax(lb).cwiseMin(ub);
+			if (mesh.use_barrier) {
+				VectorX clamped = new_x.cast<real>();
+				mesh.clamp_to_feasible(x.cast<real>(), clamped);
+				new_x = clamped.cast<float>();
+			}
+			new_energy = scaled_energy(new_x, new_grad);
+			if (std::isfinite(new_energy) && new_energy < energy
+			    && new_energy <= energy + 1e-4f * grad.dot(new_x - x)) {
+				accepted = true;
+				break;
+			}
+			alpha *= 0.5f;
+		}
+		float_iterations++;
+		if (!accepted) {
+			converged = true;
+			break;
+		}
+
+		VectorXf s = new_x - x;
+		pairs.add(s, new_grad - grad);
+
+		x.swap(new_x);
+		grad.swap(new_grad);
+		energy = new_energy;
+		moved = true;
+		if (s.lpNorm<Eigen::Infinity>() < float_tolerance) {
+			converged = true;
+			break;
+		}
+	}
+
+	if (moved) {
+		// otherwise keep the double precision digits
+		mesh.x = x.cast<real>();
+	}
+	return converged;
+}
+
+std::unique_ptr<Simulator> MixedPrecision::clone() const {
+	return std::make_unique<MixedPrecision>(*this);
+}
+
+void MixedPrecision::menu_callback() {
+	ImGui::InputInt("float iterations", &max_float_iterations);
+	ImGui::Text("Iterations: %d float, %d double", float_iterations, refinement.iterations);
+}
+
+}
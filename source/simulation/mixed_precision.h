@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common/common.h"
+
+#include "simulation/simulator.h"
+#include "simulation/lbfgs.h"
+
+namespace ruffles::simulation {
+
+/// Projected L-BFGS in single precision, finished by a few iterations of the
+/// double precision LBFGS per step. The float iterations evaluate
+/// SimulationMesh::energy on Eigen::VectorXf, whose bending kernel fits twice
+/// as many corners into a vector register. They stop once no coordinate moves
+/// further than float_tolerance, or float can't resolve the energy decrease.
+class MixedPrecision : public Simulator {
+public:
+	MixedPrecision(const SimulationMesh &mesh);
+
+	virtual void reset(const SimulationMesh &mesh);
+
+	virtual bool step(SimulationMesh &mesh) override;
+
+	virtual void menu_callback() override;
+
+	virtual std::unique_ptr<Simulator> clone() const override;
+
+	int max_float_iterations = 1000;
+	float float_tolerance = 1e-3; // cm, well below the 0.1mm we need for outlines
+	int history = 6; // correction pairs of the float L-BFGS
+
+	// warm started, param.max_iterations per step
+	LBFGS refinement;
+
+	int float_iterations = 0;
+
+private:
+	bool float_phase(SimulationMesh &mesh);
+
+	bool float_converged = false;
+};
+
+}
@@ -0,0 +1,129 @@
+#include "simulation/newton.h"
+
+#include "common/imgui.h"
+
+#include <chrono>
+
+namespace ruffles::simulation {
+
+Newton::Newton(const SimulationMesh &mesh) {
+	reset(mesh);
+}
+
+void Newton::reset(const SimulationMesh &) {
+	energy = std::numeric_limits<real>::infinity();
+	regularization = 0.;
+	iterations = 0;
+}
+
+bool Newton::step(SimulationMesh &mesh) {
+	const int n = mesh.dof();
+	VectorX lb = mesh.lb.replicate(n/2, 1);
+	VectorX ub = mesh.ub.replicate(n/2, 1);
+
+	mesh.make_feasible();
+	VectorX grad = VectorX::Zero(n);
+	energy = mesh.energy(mesh.x, &grad);
+
+	// variables at a bound whose gradient points outside are kept fixed
+	VectorXb active(n);
+	for (int i = 0; i < n; i++) {
+		active(i) = (mesh.x(i) <= lb(i) && grad(i) > 0.)
+		         || (mesh.x(i) >= ub(i) && grad(i) < 0.);
+	}
+
+	VectorX projected_grad = mesh.x - (mesh.x - grad).cwiseMax(lb).cwiseMin(ub);
+	if (projected_grad.norm() <= epsilon * max(1., mesh.x.norm())) {
+		return !mesh.relax_air_mesh();
+	}
+
+	triplets.clear();
+	mesh.hessian(mesh.x, triplets, true);
+	for (auto &t : triplets) {
+		if (active(t.row()) || active(t.col())) {
+			// keep the entry so the sparsity pattern does not depend on the active set
+			t = Eigen::Triplet<real>(t.row(), t.col(), 0.);
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		triplets.emplace_back(i, i, active(i) ? 1. : 0.);
+	}
+	hessian.resize(n, n);
+	hessian.setFromTriplets(triplets.begin(), triplets.end());
+
+	VectorX rhs = -grad;
+	for (int i = 0; i < n; i++) {
+		if (active(i)) rhs(i) = 0.;
+	}
+
+	// increase the diagonal shift until we get a descent direction
+	VectorX dir;
+	VectorX diagonal = hessian.diagonal();
+	real diagonal_scale = max(1., diagonal.cwiseAbs().maxCoeff());
+	for (int attempt = 0; attempt < 20; attempt++) {
+		Eigen::SparseMatrix<real> shifted = hessian;
+		if (regularization > 0.) {
+			for (int i = 0; i < n; i++) {
+				if (!active(i)) shifted.coeffRef(i, i) += regularization * diagonal_scale;
+			}
+		}
+		// the pattern only depends on the mesh and air mesh topology
+		if (solver_cache.factorize(shifted, SolverCache::key(mesh))) {
+			dir = solver_cache.solve(rhs);
+			if (dir.allFinite() && dir.dot(grad) < 0.) {
+				break;
+			}
+		}
+		dir.resize(0);
+		regularization = max(min_regularization, 10. * regularization);
+	}
+	if (dir.size() == 0) {
+		// no descent direction, fall back to steepest descent
+		dir = rhs;
+	}
+
+	// projected backtracking line search
+	auto line_search_start = std::chrono::steady_clock::now();
+	real alpha = 1.;
+	bool decreased = false;
+	for (int i = 0; i < max_linesearch; i++) {
+		VectorX x = (mesh.x + alpha * dir).cwiseMax(lb).cwiseMin(ub);
+		mesh.clamp_to_feasible(mesh.x, x);
+		real e = mesh.energy(x, nullptr);
+		if (e <= energy + armijo * grad.dot(x - mesh.x)) {
+			mesh.x = x;
+			energy = e;
+			decreased = true;
+			break;
+		}
+		alpha *= 0.5;
+	}
+	mesh.statistics.line_search_time += std::chrono::duration<real>(std::chrono::steady_clock::now() - line_search_start).count();
+	if (decreased && alpha == 1.) {
+		regularization *= 0.1;
+		if (regularization < min_regularization) {
+			regularization = 0.;
+		}
+	}
+	iterations++;
+
+	if (mesh.relax_air_mesh()) {
+		// air mesh changed, run again
+		return false;
+	}
+	// line search failure means we can't make any more progress
+	return !decreased;
+}
+
+std::unique_ptr<Simulator> Newton::clone() const {
+	return std::make_unique<Newton>(*this);
+}
+
+void Newton::menu_callback() {
+	ImGui::InputReal("epsilon", &epsilon, 1e-6, 1e-4, "%.2e");
+	ImGui::Text("Iterations: %d", iterations);
+	ImGui::Text("Regularization: %.2e", regularization);
+	ImGui::Text("Symbolic/numeric factorizations: %d/%d", solver_cache.analyze_count, solver_cache.factorize_count);
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common/common.h"
+
+#include "simulation/simulator.h"
+
+namespace ruffles::simulation {
+
+/// Projected Newton's method on the sparse (PSD-projected) hessian of
+/// SimulationMesh::energy, with backtracking line search and active-set
+/// handling of the lb/ub bounds
+class Newton : public Simulator {
+public:
+	Newton(const SimulationMesh &mesh);
+
+	virtual void reset(const SimulationMesh &mesh);
+
+	virtual bool step(SimulationMesh &mesh) override;
+
+	virtual void menu_callback() override;
+
+	virtual std::unique_ptr<Simulator> clone() const override;
+
+	real energy = std::numeric_limits<real>::infinity();
+	real epsilon = 1e-5; // relative tolerance on the projected gradient
+	real regularization = 0.; // current diagonal shift, adapted per step
+	real min_regularization = 1e-8;
+	int max_linesearch = 30;
+	real armijo = 1e-4;
+
+	int iterations = 0;
+
+private:
+	Eigen::SparseMatrix<real> hessian;
+	vector<Eigen::Triplet<real>> triplets;
+};
+
+}
@@ -0,0 +1,185 @@
+#include "simulation/projective_dynamics.h"
+
+#include "common/imgui.h"
+
+namespace ruffles::simulation {
+
+ProjectiveDynamics::ProjectiveDynamics(const SimulationMesh &mesh) {
+	reset(mesh);
+}
+
+void ProjectiveDynamics::reset(const SimulationMesh &) {
+	iterations = 0;
+}
+
+void ProjectiveDynamics::prefactor(const SimulationMesh &mesh) {
+	const SimulationMesh::Compiled &c = mesh.compiled();
+	const int n_fixed = c.n_slots - c.n_free;
+
+	// weights w of the quadratic terms w/2 |A x - p|^2 matching the energy
+	segment_weight = VectorX::Constant(c.segments.size(), 2*mesh.k_global*mesh.lambda_membrane);
+	bend_weight.resize(c.bends.size());
+	for (size_t i = 0; i < c.bends.size(); i++) {
+		real l1 = c.length(c.bend_segments[i][0]);
+		real l2 = c.length(c.bend_segments[i][1]);
+		real k = mesh.k_global*mesh.k_bend*c.width(c.bends[i][1])/(0.5*(l1+l2));
+		// both edges rotate by half the turning angle
+		bend_weight(i) = 8*k / (l1*l1 + l2*l2);
+	}
+
+	inertia.resize(c.n_free);
+	for (int slot = 0; slot < c.n_free; slot++) {
+		inertia(slot) = mesh.k_global * mesh.m(2*slot) / (dt*dt) + 1e-8;
+	}
+
+	// the same scalar matrix acts on x and y coordinates
+	vector<Eigen::Triplet<real>> free_free, free_fixed;
+	auto add = [&](int i, int j, real value) {
+		if (i >= c.n_free) return;
+		if (j < c.n_free) {
+			free_free.emplace_back(i, j, value);
+		} else {
+			free_fixed.emplace_back(i, j - c.n_free, value);
+		}
+	};
+	for (size_t i = 0; i < c.segments.size(); i++) {
+		auto [s, e] = c.segments[i];
+		real w = segment_weight(i);
+		add(s, s, w); add(s, e, -w);
+		add(e, s, -w); add(e, e, w);
+	}
+	for (size_t i = 0; i < c.bends.size(); i++) {
+		auto [a, b, cc] = c.bends[i];
+		real w = bend_weight(i);
+		add(a, a, w);    add(a, b, -w);
+		add(b, a, -w);   add(b, b, 2*w);  add(b, cc, -w);
+		                 add(cc, b, -w);  add(cc, cc, w);
+	}
+	for (int slot = 0; slot < c.n_free; slot++) {
+		add(slot, slot, inertia(slot));
+	}
+
+	Eigen::SparseMatrix<real> system(c.n_free, c.n_free);
+	system.setFromTriplets(free_free.begin(), free_free.end());
+	Eigen::SparseMatrix<real> coupling(c.n_free, n_fixed);
+	coupling.setFromTriplets(free_fixed.begin(), free_fixed.end());
+
+	constant_rhs = -(coupling * c.fixed_positions.transpose()).transpose();
+	for (int slot = 0; slot < c.n_free; slot++) {
+		constant_rhs.col(slot) += mesh.k_global * c.mass(slot) * mesh.gravity;
+	}
+	for (auto &[v, m] : c.extra_mass) {
+		if (v < c.n_free) constant_rhs.col(v) += mesh.k_global * m * mesh.gravity;
+	}
+	for (auto &[v, f] : c.external_forces) {
+		if (v < c.n_free) constant_rhs.col(v) += mesh.k_global * f;
+	}
+
+	if (!solver_cache.factorize(system, SolverCache::key(mesh, false))) {
+		cerr << "ProjectiveDynamics: factorization failed" << endl;
+	}
+
+	segment_targets.resize(2, c.segments.size());
+	bend_targets.resize(4, c.bends.size());
+
+	factorized_parameters = c.parameters_version;
+	factorized_topology = mesh.topology_version;
+	factorized_dt = dt;
+}
+
+void ProjectiveDynamics::local_step(const SimulationMesh::Compiled &c, const Matrix<real, 2, -1> &pos) {
+	// every constraint only writes its own target
+	for (size_t i = 0; i < c.segments.size(); i++) {
+		auto [s, e] = c.segments[i];
+		Vector2 d = pos.col(e) - pos.col(s);
+		real h = d.norm();
+		if (h > 0.) {
+			segment_targets.col(i) = c.length(i) / h * d;
+		} else {
+			segment_targets.col(i) = Vector2(c.length(i), 0.);
+		}
+	}
+	for (size_t i = 0; i < c.bends.size(); i++) {
+		auto [a, b, cc] = c.bends[i];
+		Vector2 e1 = pos.col(b) - pos.col(a);
+		Vector2 e2 = pos.col(cc) - pos.col(b);
+		real l1 = e1.norm();
+		real l2 = e2.norm();
+		// closest straight corner keeping both edge lengths
+		Vector2 t = e1/l1 + e2/l2;
+		if (t.squaredNorm() < 1e-12) {
+			t = e1/l1; // folded back onto itself
+		}
+		t.normalize();
+		bend_targets.col(i) << l1*t, l2*t;
+	}
+}
+
+bool ProjectiveDynamics::step(SimulationMesh &mesh) {
+	const SimulationMesh::Compiled &c = mesh.compiled();
+	if (c.parameters_version != factorized_parameters
+	 || mesh.topology_version != factorized_topology
+	 || dt != factorized_dt) {
+		prefactor(mesh);
+	}
+
+	Matrix<real, 2, -1> pos(2, c.n_slots);
+	pos.rightCols(c.n_slots - c.n_free) = c.fixed_positions;
+	Eigen::Map<Matrix<real, 2, -1>> x(mesh.x.data(), 2, c.n_free);
+
+	real max_change = infinity;
+	for (int it = 0; it < iterations_per_step; it++) {
+		pos.leftCols(c.n_free) = x;
+		local_step(c, pos);
+
+		// global step: gather the projections into the right hand side
+		Matrix<real, 2, -1> rhs = constant_rhs;
+		rhs += x * inertia.asDiagonal();
+		Matrix<real, 2, -1> targets = Matrix<real, 2, -1>::Zero(2, c.n_slots);
+		for (size_t i = 0; i < c.segments.size(); i++) {
+			auto [s, e] = c.segments[i];
+			Vector2 p = segment_weight(i) * segment_targets.col(i);
+			targets.col(s) -= p;
+			targets.col(e) += p;
+		}
+		for (size_t i = 0; i < c.bends.size(); i++) {
+			auto [a, b, cc] = c.bends[i];
+			Vector2 p1 = bend_weight(i) * bend_targets.col(i).head<2>();
+			Vector2 p2 = bend_weight(i) * bend_targets.col(i).tail<2>();
+			targets.col(a) -= p1;
+			targets.col(b) += p1 - p2;
+			targets.col(cc) += p2;
+		}
+		rhs += targets.leftCols(c.n_free);
+
+		Matrix<real, 2, -1> new_x = solver_cache.solve(MatrixX(rhs.transpose())).transpose();
+		for (int i = 0; i < 2; i++) {
+			new_x.row(i) = new_x.row(i).cwiseMax(mesh.lb(i)).cwiseMin(mesh.ub(i));
+		}
+		max_change = (new_x - x).cwiseAbs().maxCoeff();
+		x = new_x;
+		iterations++;
+	}
+
+	mesh.air_mesh.project(mesh.x);
+
+	if (mesh.relax_air_mesh()) {
+		// air mesh changed, run again
+		return false;
+	}
+	return max_change < epsilon;
+}
+
+std::unique_ptr<Simulator> ProjectiveDynamics::clone() const {
+	return std::make_unique<ProjectiveDynamics>(*this);
+}
+
+void ProjectiveDynamics::menu_callback() {
+	if (ImGui::InputReal("dt", &dt, 0.001, 0.01)) {
+		dt = max(1e-6, dt);
+	}
+	ImGui::InputInt("iterations per step", &iterations_per_step);
+	ImGui::Text("Iterations: %d", iterations);
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common/common.h"
+
+#include "simulation/simulator.h"
+
+namespace ruffles::simulation {
+
+/// Local/global projective dynamics. The local step projects every segment
+/// onto its rest length and every bending corner onto a straight corner with
+/// the current edge lengths; each projection is independent of the others.
+/// The global step is a constant linear system (one per coordinate, sharing
+/// the matrix) that is only refactorized when lengths, widths or masses change.
+/// Inversions of the air mesh are resolved by AirMesh::project after each
+/// global step.
+class ProjectiveDynamics : public Simulator {
+public:
+	ProjectiveDynamics(const SimulationMesh &mesh);
+
+	virtual void reset(const SimulationMesh &mesh);
+
+	virtual bool step(SimulationMesh &mesh) override;
+
+	virtual void menu_callback() override;
+
+	virtual std::unique_ptr<Simulator> clone() const override;
+
+	real dt = 0.01; // pseudo time step of the inertia term regularizing the global step
+	int iterations_per_step = 20;
+	real epsilon = 1e-5; // maximum change of any coordinate (cm) to be converged
+
+	int iterations = 0;
+
+private:
+	void prefactor(const SimulationMesh &mesh);
+	void local_step(const SimulationMesh::Compiled &c, const Matrix<real, 2, -1> &pos);
+
+	long factorized_parameters = -1;
+	long factorized_topology = -1;
+	real factorized_dt = 0.;
+
+	VectorX segment_weight;
+	VectorX bend_weight;
+	VectorX inertia; // per free slot
+	Matrix<real, 2, -1> constant_rhs; // external forces minus the coupling to fixed vertices
+
+	Matrix<real, 2, -1> segment_targets;
+	Matrix<real, 4, -1> bend_targets;
+};
+
+}
@@ -1,5 +1,7 @@
 #include "simulation/simulation_mesh.h"
+#include "common/thread_pool.h"
 #include <numeric>
+#include <chrono>
 
 
 namespace ruffles::simulation {
@@ -8,7 +10,15 @@ using Segment = SimulationMesh::Segment;
 using Vertex = SimulationMesh::Vertex;
 
 listref<Vertex> SimulationMesh::push_vertex(Vector2 position, bool fixed) {
-	air_mesh.clear();
+	listref<Vertex> res = append_vertex(position, fixed);
+	if (!air_mesh.empty() && (!incremental_air_mesh || !air_mesh.insert(*this, res.id()))) {
+		air_mesh.clear();
+	}
+	return res;
+}
+
+listref<Vertex> SimulationMesh::append_vertex(Vector2 position, bool fixed) {
+	invalidate_topology();
 	if (fixed) {
 		return vertices.insert(vertices.end(), Vertex(position));
 	} else {
@@ -27,12 +37,18 @@ listref<Segment> SimulationMesh::push_segment(listref<Vertex> a, listref<Vertex>
 	return insert_segment(a,b,length,segments.end());
 }
 listref<Segment> SimulationMesh::insert_segment(listref<Vertex> a, listref<Vertex> b, real length, listref<Segment> position) {
+	invalidate_topology();
+	if (incremental_air_mesh && !air_mesh.empty() && !air_mesh.insert_constraint(*this, a.id(), b.id())) {
+		air_mesh.clear();
+	}
 	return segments.insert(position, Segment(a,b,length));
 }
 
 array<listref<Segment>, 2> SimulationMesh::split_segment(listref<Segment> seg) {
 	Vector2 center_pos = 0.5 * (get_vertex_position(*seg->start) + get_vertex_position(*seg->end));
-	listref<Vertex> center = push_vertex(center_pos);
+	// split the constrained edge of the air mesh instead of locating the new
+	// vertex like push_vertex does
+	listref<Vertex> center = append_vertex(center_pos);
 	center->width = 0.5*(seg->start->width + seg->end->width);
 	if (seg->start->z.size() && seg->end->z.size()) {
 		center->z = {
@@ -41,46 +57,14 @@ array<listref<Segment>, 2> SimulationMesh::split_segment(listref<Segment> seg) {
 		};
 	}
 	center->width = 0.5*(seg->start->width + seg->end->width);
+	if (!air_mesh.empty() && (!incremental_air_mesh || !air_mesh.split(*this, seg->start.id(), seg->end.id(), center.id()))) {
+		air_mesh.clear();
+	}
 	listref<Segment> a = insert_segment(seg->start, center, 0.5*seg->length, seg);
 	listref<Segment> b = insert_segment(center, seg->end, 0.5*seg->length, seg);
 
-	auto mark_constrained = [this](auto f, int i, bool constrained) {
-		f->set_constraint(i, constrained);
-		f->neighbor(i)->set_constraint(air_mesh.cdt.mirror_index(f,i), constrained);
-	};
-
-	if (!air_mesh.empty()) {
-		// TODO: update air mesh
-		int center_ix = air_mesh.vertices.size();
-		air_mesh.vertices.push_back(static_cast<std::variant<Vector2,int>>(*center));
-		int start_ix = std::distance(vertices.begin(), seg->start);
-		int end_ix   = std::distance(vertices.begin(), seg->end);
-
-		// TODO: find the edge faster
-		for (auto it = air_mesh.cdt.finite_edges_begin(); it != air_mesh.cdt.finite_edges_end(); ++it) {
-			if (it->first->vertex((it->second+1)%3)->info() == start_ix &&
-			    it->first->vertex((it->second+2)%3)->info() == end_ix) {
-				mark_constrained(it->first, it->second, false);
-				auto center_vx = air_mesh.cdt.tds().insert_in_edge(it->first, it->second);
-				center_vx->info() = center_ix;
-				auto c = center_vx->incident_edges();
-				bool found_first = false;
-				bool found_second = false;
-				do {
-					if ((c->first->vertex((c->second+1)%3)->info() == start_ix)
-					 || (c->first->vertex((c->second+1)%3)->info() == end_ix)
-					 || (c->first->vertex((c->second+2)%3)->info() == start_ix)
-					 || (c->first->vertex((c->second+2)%3)->info() == end_ix)) {
-						mark_constrained(c->first, c->second, true);
-					}
-				} while (++c != center_vx->incident_edges());
-				
-				cout << "Found!!!!" << endl;
-				break;
-			}
-		}
-	}
 	segments.erase(seg);
+	invalidate_topology();
 
 	return {a,b};
 	
@@ -103,6 +87,11 @@ void SimulationMesh::cleanup() {
 		dof_new += used[i];
 	}
 
+	// before renumbering, the air mesh needs the old indices to find erased vertices
+	if (!air_mesh.empty() && (!incremental_air_mesh || !air_mesh.cleanup(*this, newindex))) {
+		air_mesh.clear();
+	}
+
 	for (auto &v : vertices) {
 		if (int *ix = get_if<int>(&v)) {
 			*ix = newindex[*ix];
@@ -117,6 +106,7 @@ void SimulationMesh::cleanup() {
 	}
 	assert(!new_x.hasNaN());
 	x = new_x;
+	invalidate_topology();
 }
 
 void SimulationMesh::update_vertex_mass() {
@@ -124,16 +114,32 @@ void SimulationMesh::update_vertex_mass() {
 		vert.mass = 0.;
 	}
 	for (auto &seg : segments) {
-		real half_length = 0.5*seg.length;
-		real center_width = 0.5*(seg.start->width+seg.end->width);
-		seg.start->mass += 0.5*(seg.start->width+center_width)*half_length * density;
-		seg.end->mass   += 0.5*(seg.end->width  +center_width)*half_length * density;
+		array<real, 2> mass = segment_mass(seg);
+		seg.start->mass += mass[0];
+		seg.end->mass   += mass[1];
 	}
 	for (auto &vert : vertices) {
 		if (int *ix = get_if<int>(&vert)) {
 			m.segment<2>(2**ix) = Vector2(vert.mass, vert.mass);
 		}
 	}
+	invalidate_parameters();
+}
+
+array<real, 2> SimulationMesh::segment_mass(const Segment &seg) const {
+	real half_length = 0.5*seg.length;
+	real center_width = 0.5*(seg.start->width+seg.end->width);
+	return {
+		0.5*(seg.start->width+center_width)*half_length * density,
+		0.5*(seg.end->width  +center_width)*half_length * density
+	};
+}
+
+void SimulationMesh::set_vertex_mass(Vertex &vert, real mass) {
+	vert.mass = mass;
+	if (int *ix = get_if<int>(&vert)) {
+		m.segment<2>(2**ix) = Vector2(mass, mass);
+	}
 }
 
 Vector2 SimulationMesh::get_vertex_position(Vertex &vx) const {
@@ -147,57 +153,70 @@ Vector2 SimulationMesh::get_vertex_position(Vertex &vx) const {
 	return res;
 }
 
-real SimulationMesh::energy(const VectorX &x, VectorX *grad) const {
-	auto get_vertex = [&](Vertex &vx) -> Vector2 {
-		return get_vertex_position(vx);
-	};
-
-	if (grad) {
-		grad->setZero();
-		assert(x.size() == grad->size());
-	}
-
-
-	real res = 0.;
+void SimulationMesh::invalidate_topology() {
+	topology_version = next_version();
+	compiled_topology_valid = false;
+	compiled_parameters_valid = false;
+}
 
-	// bending energy
-	Vector6 grad_theta = Vector6::Zero();
-	auto add_bending_energy = [&](listref<Vertex> a, listref<Vertex> b, listref<Vertex> c, real avg_length) {
-		Vector6 corner;
-		corner <<
-			get_vertex(*a),
-			get_vertex(*b),
-			get_vertex(*c);
+void SimulationMesh::invalidate_parameters() {
+	compiled_parameters_valid = false;
+}
 
-		real theta = angle(corner, grad ? &grad_theta : nullptr);
-		real theta_tilde = M_PI;
+const SimulationMesh::Compiled &SimulationMesh::compiled() const {
+	if (!compiled_topology_valid) {
+		compile_topology();
+	}
+	if (!compiled_parameters_valid) {
+		compile_parameters();
+	}
+	return compiled_mesh;
+}
 
-		real energy_local = (theta-theta_tilde)*(theta-theta_tilde);
-		res += k_global*k_bend*b->width/avg_length * energy_local;
-		if (grad) {
-			real fac = k_global*k_bend*b->width/avg_length*2*(theta-theta_tilde);
-			if (int *ax = get_if<int>(&*a))
-				grad->segment<2>(2**ax) += fac * grad_theta.segment<2>(0);
-			if (int *bx = get_if<int>(&*b))
-				grad->segment<2>(2**bx) += fac * grad_theta.segment<2>(2);
-			if (int *cx = get_if<int>(&*c))
-				grad->segment<2>(2**cx) += fac * grad_theta.segment<2>(4);
+void SimulationMesh::compile_topology() const {
+	Compiled &c = compiled_mesh;
+	c = Compiled();
+
+	c.n_free = dof()/2;
+	c.n_slots = c.n_free;
+	c.vertex_refs.resize(c.n_free, nullptr);
+	c.slot.assign(vertices.capacity(), -1);
+	for (auto vert = vertices.begin(); vert != vertices.end(); ++vert) {
+		int slot;
+		if (const int *ix = get_if<int>(&*vert)) {
+			slot = *ix;
+		} else {
+			slot = c.n_slots++;
+			c.vertex_refs.push_back(nullptr);
 		}
-	};
+		c.vertex_refs[slot] = &*vert;
+		c.slot[vert.index()] = slot;
+	}
+
+	vector<int> segment_index(segments.capacity(), -1);
+	for (auto seg = segments.begin(); seg != segments.end(); ++seg) {
+		segment_index[seg.index()] = c.segments.size();
+		c.segments.push_back({c.slot[seg->start.index()], c.slot[seg->end.index()]});
+		c.segment_refs.push_back(&*seg);
+	}
 
-	for (auto it = segments.begin(); std::next(it) != segments.end(); ++it) {
-		assert(it->end == std::next(it)->start);
-		add_bending_energy(it->start, it->end, std::next(it)->end, 0.5*(it->length + std::next(it)->length));
+	for (int i = 0; i+1 < (int)c.segments.size(); i++) {
+		assert(c.segments[i][1] == c.segments[i+1][0]);
+		c.bends.push_back({c.segments[i][0], c.segments[i][1], c.segments[i+1][1]});
+		c.bend_segments.push_back({i, i+1});
 	}
 	for (auto &[a,b] : connection_bends) {
-		array<listref<Vertex>, 4> points {
-			a->start,
-			a->end,
-			b->start,
-			b->end,
+		int ia = segment_index[a.index()];
+		int ib = segment_index[b.index()];
+		array<int, 4> points {
+			c.segments[ia][0],
+			c.segments[ia][1],
+			c.segments[ib][0],
+			c.segments[ib][1],
 		};
 
-		listref<Vertex> x,y,z;
+		// the shared vertex is the corner, the other two are the ends
+		int y = -1;
 		for (int i = 0; i < 4; i++) {
 			for (int j = i+1; j < 4; j++) {
 				if (points[i] == points[j]) {
@@ -205,71 +224,405 @@ real SimulationMesh::energy(const VectorX &x, VectorX *grad) const {
 				}
 			}
 		}
-		bool has_x = false;
+		array<int, 2> ends;
+		int n_ends = 0;
 		for (int i = 0; i < 4; i++) {
-			if(points[i] == y)
-				continue;
-			if (has_x) {
-				z = points[i];
-			} else {
-				x = points[i];
-				has_x = true;
+			if (points[i] != y && n_ends < 2) {
+				ends[n_ends++] = points[i];
 			}
 		}
 
-		add_bending_energy(x,y,z, 0.5*(a->length + b->length));
+		c.bends.push_back({ends[0], y, ends[1]});
+		c.bend_segments.push_back({ia, ib});
 	}
 
-	// membrane energy / constraint
-	for (auto seg : segments) {
-		real h_tilde = seg.length;
-		Vector2 a = get_vertex(*seg.start);
-		Vector2 b = get_vertex(*seg.end);
-		Vector2 d = b-a;
-		
-		real h = d.norm();
+	compiled_topology_valid = true;
+	compiled_parameters_valid = false;
+}
+
+void SimulationMesh::compile_parameters() const {
+	Compiled &c = compiled_mesh;
+
+	c.fixed_positions.resize(2, c.n_slots - c.n_free);
+	c.width = VectorX::Zero(c.n_slots);
+	c.mass = VectorX::Zero(c.n_slots);
+	for (int slot = 0; slot < c.n_slots; slot++) {
+		const Vertex *vert = c.vertex_refs[slot];
+		if (!vert) {
+			// unused entry of x, left over until the next cleanup()
+			continue;
+		}
+		c.width(slot) = vert->width;
+		c.mass(slot) = vert->mass;
+		if (const Vector2 *pos = get_if<Vector2>(vert)) {
+			c.fixed_positions.col(slot - c.n_free) = *pos;
+		}
+	}
+
+	c.length.resize(c.segments.size());
+	for (int i = 0; i < (int)c.segments.size(); i++) {
+		c.length(i) = c.segment_refs[i]->length;
+	}
 
-		res += k_global * lambda_membrane * (h-h_tilde)*(h-h_tilde);
+	c.extra_mass.clear();
+	for (auto &[v, m] : extra_mass) {
+		c.extra_mass.emplace_back(c.slot[v.index()], m);
+	}
+	c.external_forces.clear();
+	for (auto &[v, f] : external_forces) {
+		c.external_forces.emplace_back(c.slot[v.index()], f);
+	}
+
+	c.parameters_version = next_version();
+	compiled_parameters_valid = true;
+}
+
+// below this many bends and segments the energy is not worth distributing over threads
+static const int min_parallel_items = 8192;
+
+real SimulationMesh::energy(const VectorX &x, VectorX *grad) const {
+	auto start = std::chrono::steady_clock::now();
+	real res = energy_impl(x, grad);
 
+	statistics.energy_evaluations++;
+	statistics.gradient_evaluations += grad != nullptr;
+	statistics.energy_time += std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count();
+
+	return res;
+}
+
+float SimulationMesh::energy(const Eigen::VectorXf &x, Eigen::VectorXf *grad) const {
+	auto start = std::chrono::steady_clock::now();
+	float res = energy_impl(x, grad);
+
+	statistics.energy_evaluations++;
+	statistics.gradient_evaluations += grad != nullptr;
+	statistics.energy_time += std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count();
+
+	return res;
+}
+
+template<typename Scalar>
+Scalar SimulationMesh::energy_impl(const Matrix<Scalar, -1, 1> &x, Matrix<Scalar, -1, 1> *grad) const {
+	using Vector2s = Matrix<Scalar, 2, 1>;
+	const Compiled &c = compiled();
+	assert(x.size() == 2*c.n_free);
+
+	if (grad) {
+		grad->setZero();
+		assert(x.size() == grad->size());
+	}
+
+	// gather all vertex positions, fixed ones behind the movable ones
+	Matrix<Scalar, 2, -1> pos(2, c.n_slots);
+	pos.leftCols(c.n_free) = Eigen::Map<const Matrix<Scalar, 2, -1>>(x.data(), 2, c.n_free);
+	pos.rightCols(c.n_slots - c.n_free) = c.fixed_positions.template cast<Scalar>();
+
+	Matrix<Scalar, 2, -1> g;
+	if (grad) {
+		g.setZero(2, c.n_slots);
+	}
+
+	// bending and membrane terms, split over threads for large meshes
+	int n_items = c.bends.size() + c.segments.size();
+	ThreadPool &pool = ThreadPool::global();
+	bool parallel = n_items >= min_parallel_items && pool.size() > 1;
+	int n_chunks = parallel ? pool.size() : 1;
+
+	vector<Scalar> chunk_res(n_chunks, 0.);
+	// chunk 0 accumulates into g directly, the others into their own buffers.
+	// These are zeroed up front: parallel_for runs everything as chunk 0 when
+	// it is called from inside the pool or the pool is busy.
+	vector<Matrix<Scalar, 2, -1>> chunk_grad(grad ? n_chunks-1 : 0, Matrix<Scalar, 2, -1>::Zero(2, c.n_slots));
+	auto run = [&](int chunk, int begin, int end) {
+		Matrix<Scalar, 2, -1> *target = nullptr;
+		if (grad) {
+			target = chunk > 0 ? &chunk_grad[chunk-1] : &g;
+		}
+		chunk_res[chunk] = elastic_energy(c, pos, begin, end, target);
+	};
+	if (parallel) {
+		pool.parallel_for(n_items, run);
 		if (grad) {
-			Vector2 dhda = 1/(2*h) * -d;
-			Vector2 dhdb = 1/(2*h) *  d;
-			if (int *ix = get_if<int>(&*seg.start))
-				grad->segment<2>(2**ix) += k_global*lambda_membrane * 2*(h-h_tilde)*dhda;
-			if (int *ix = get_if<int>(&*seg.end))
-				grad->segment<2>(2**ix) += k_global*lambda_membrane * 2*(h-h_tilde)*dhdb;
+			pool.parallel_for(c.n_slots, [&](int, int begin, int end) {
+				for (auto &cg : chunk_grad) {
+					g.middleCols(begin, end-begin) += cg.middleCols(begin, end-begin);
+				}
+			});
 		}
+	} else {
+		run(0, 0, n_items);
 	}
-	
+
+	Scalar res = 0.;
+	for (Scalar r : chunk_res) {
+		res += r;
+	}
+
 	// gravity
+	const Scalar k = k_global;
+	const Vector2s gs = gravity.cast<Scalar>();
 
 	// intrinsic mass
-	for (auto vert : vertices) {
-		res -= k_global * vert.mass * get_vertex_position(vert).dot(gravity);
+	res -= k * (c.mass.template cast<Scalar>().transpose() * (gs.transpose() * pos).transpose())(0);
+	if (grad) {
+		g -= k * gs * c.mass.template cast<Scalar>().transpose();
+	}
+
+	// extrinsic mass
+	for (auto &[v, m] : c.extra_mass) {
+		res -= k * Scalar(m) * pos.col(v).dot(gs);
+		if (grad) {
+			g.col(v) -= k * Scalar(m) * gs;
+		}
+	}
+
+	// external forces
+	for (auto &[v, f] : c.external_forces) {
+		res -= k * pos.col(v).dot(f.template cast<Scalar>());
 		if (grad) {
-			if (int *ix = get_if<int>(&vert)) {
-				grad->segment<2>(2**ix) -= k_global * vert.mass * gravity;
+			g.col(v) -= k * f.template cast<Scalar>();
+		}
+	}
+
+	if (grad) {
+		// gradients of fixed slots are dropped
+		*grad += Eigen::Map<const Matrix<Scalar, -1, 1>>(g.data(), 2*c.n_free);
+	}
+
+	// the air mesh works in double precision
+	auto air_mesh_term = [&](const VectorX &xd, VectorX *gd) {
+		if (use_barrier) {
+			return air_mesh.barrier(k_global * lambda_air_mesh, xd, gd);
+		} else {
+			return air_mesh.penalty(k_global * lambda_air_mesh, xd, gd);
+		}
+	};
+	if constexpr (std::is_same_v<Scalar, real>) {
+		res += air_mesh_term(x, grad);
+	} else if (!air_mesh.empty()) {
+		VectorX gd;
+		if (grad) {
+			gd.setZero(x.size());
+		}
+		res += Scalar(air_mesh_term(x.template cast<real>(), grad ? &gd : nullptr));
+		if (grad) {
+			*grad += gd.cast<Scalar>();
+		}
+	}
+
+	return res;
+}
+
+template<typename Scalar>
+Scalar SimulationMesh::elastic_energy(const Compiled &c, const Matrix<Scalar, 2, -1> &pos, int begin, int end, Matrix<Scalar, 2, -1> *g) const {
+	using Vector2s = Matrix<Scalar, 2, 1>;
+	Scalar res = 0.;
+
+	// bending energy, angle_batch_size corners at a time
+	int n_bends = c.bends.size();
+	int bend_end = std::min(end, n_bends);
+	array<AngleBatchOf<Scalar>, 6> corners, grad_theta;
+	for (int first = begin; first < bend_end; first += angle_batch_size) {
+		int n = std::min(angle_batch_size, bend_end - first);
+		for (int lane = 0; lane < angle_batch_size; lane++) {
+			// unused lanes repeat the last corner and are ignored below
+			auto [a, b, cc] = c.bends[first + std::min(lane, n-1)];
+			for (int k = 0; k < 2; k++) {
+				corners[0+k](lane) = pos(k, a);
+				corners[2+k](lane) = pos(k, b);
+				corners[4+k](lane) = pos(k, cc);
+			}
+		}
+
+		AngleBatchOf<Scalar> theta = angle_batch(corners, g ? &grad_theta : nullptr);
+		Scalar theta_tilde = M_PI;
+
+		for (int lane = 0; lane < n; lane++) {
+			int i = first + lane;
+			auto [a, b, cc] = c.bends[i];
+			real avg_length = 0.5*(c.length(c.bend_segments[i][0]) + c.length(c.bend_segments[i][1]));
+
+			Scalar k = k_global*k_bend*c.width(b)/avg_length;
+			res += k * (theta(lane)-theta_tilde)*(theta(lane)-theta_tilde);
+			if (g) {
+				Scalar fac = k*2*(theta(lane)-theta_tilde);
+				g->col(a)  += fac * Vector2s(grad_theta[0](lane), grad_theta[1](lane));
+				g->col(b)  += fac * Vector2s(grad_theta[2](lane), grad_theta[3](lane));
+				g->col(cc) += fac * Vector2s(grad_theta[4](lane), grad_theta[5](lane));
 			}
 		}
 	}
 
-	// extrinsic mass
-	for (auto &[v, m] : extra_mass) {
-		if (int *ix = get_if<int>(&*v)) {
-			grad->segment<2>(2**ix) -= k_global * m * gravity;
+	// membrane energy / constraint
+	const Scalar k_membrane = k_global * lambda_membrane;
+	for (int i = std::max(begin, n_bends) - n_bends; i < end - n_bends; i++) {
+		auto [s, e] = c.segments[i];
+		Scalar h_tilde = c.length(i);
+		Vector2s d = pos.col(e) - pos.col(s);
+
+		Scalar h = d.norm();
+
+		res += k_membrane * (h-h_tilde)*(h-h_tilde);
+
+		if (g) {
+			Vector2s dhda = 1/h * -d;
+			Vector2s dhdb = 1/h *  d;
+			g->col(s) += k_membrane * 2*(h-h_tilde)*dhda;
+			g->col(e) += k_membrane * 2*(h-h_tilde)*dhdb;
 		}
 	}
 
-	// external forces
-	for (auto &[v, f] : external_forces) {
-		res += get_vertex_position(*v).dot(f);
-		if (int *ix = get_if<int>(&*v)) {
-			grad->segment<2>(2**ix) -= k_global * f;
+	return res;
+}
+
+void SimulationMesh::hessian(const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project) const {
+	const Compiled &c = compiled();
+	assert(x.size() == 2*c.n_free);
+
+	Matrix<real, 2, -1> pos(2, c.n_slots);
+	pos.leftCols(c.n_free) = Eigen::Map<const Matrix<real, 2, -1>>(x.data(), 2, c.n_free);
+	pos.rightCols(c.n_slots - c.n_free) = c.fixed_positions;
+
+	// scatter a block over vertex slots, dropping rows/columns of fixed vertices
+	auto add_block = [&](const auto &block, const auto &slots) {
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i] >= c.n_free) continue;
+			for (size_t j = 0; j < slots.size(); j++) {
+				if (slots[j] >= c.n_free) continue;
+				addHessianBlock(block.template block<2,2>(2*i, 2*j), 2*slots[i], 2*slots[j], triplets);
+			}
+		}
+	};
+
+	// bending energy
+	for (size_t i = 0; i < c.bends.size(); i++) {
+		auto [a, b, cc] = c.bends[i];
+		real avg_length = 0.5*(c.length(c.bend_segments[i][0]) + c.length(c.bend_segments[i][1]));
+		real k = k_global*k_bend*c.width(b)/avg_length;
+
+		Vector6 corner;
+		corner <<
+			pos.col(a),
+			pos.col(b),
+			pos.col(cc);
+
+		Vector6 grad_theta;
+		Matrix6 hess_theta;
+		real theta = angle(corner, &grad_theta, &hess_theta);
+		real theta_tilde = M_PI;
+
+		Matrix6 h;
+		if (std::abs(theta-theta_tilde) < 1e-5) {
+			// acos is not differentiable at a straight corner, but (theta-pi)^2
+			// equals the squared signed turning angle phi, whose hessian there is
+			// 2 dphi dphi^T
+			auto dalpha = [](Vector2 e) -> Vector2 {
+				return Vector2(-e.y(), e.x()) / e.squaredNorm();
+			};
+			Vector2 d1 = dalpha(corner.segment<2>(2) - corner.segment<2>(0));
+			Vector2 d2 = dalpha(corner.segment<2>(4) - corner.segment<2>(2));
+			Vector6 dphi;
+			dphi << d1, -d1-d2, d2;
+			h = 2*k * dphi * dphi.transpose();
+		} else {
+			h = 2*k * (grad_theta * grad_theta.transpose() + (theta-theta_tilde) * hess_theta);
+			if (project) {
+				h = project_psd<6>(h);
+			}
 		}
+		add_block(h, array<int, 3>{a, b, cc});
+	}
+
+	// membrane energy / constraint
+	for (size_t i = 0; i < c.segments.size(); i++) {
+		auto [s, e] = c.segments[i];
+		Vector2 d = pos.col(e) - pos.col(s);
+		real h = d.norm();
+		Vector2 u = d / h;
+
+		// stretching along the segment, (h-h_tilde)/h across it
+		real across = (h - c.length(i)) / h;
+		if (project) {
+			across = max(0., across);
+		}
+		Matrix2 k = 2*k_global*lambda_membrane * (u*u.transpose() + across * (Matrix2::Identity() - u*u.transpose()));
+		Matrix4 block;
+		block <<
+			 k, -k,
+			-k,  k;
+		add_block(block, array<int, 2>{s, e});
+	}
+
+	// gravity and external forces are linear
+
+	if (use_barrier) {
+		air_mesh.barrier_hessian(k_global * lambda_air_mesh, x, triplets, project);
+	} else {
+		air_mesh.hessian(k_global * lambda_air_mesh, x, triplets, project);
+	}
+}
+
+Eigen::SparseMatrix<real> SimulationMesh::length_jacobian(const VectorX &x) const {
+	const Compiled &c = compiled();
+	assert(x.size() == 2*c.n_free);
+
+	Matrix<real, 2, -1> pos(2, c.n_slots);
+	pos.leftCols(c.n_free) = Eigen::Map<const Matrix<real, 2, -1>>(x.data(), 2, c.n_free);
+	pos.rightCols(c.n_slots - c.n_free) = c.fixed_positions;
+
+	vector<Eigen::Triplet<real>> triplets;
+	auto add = [&](int slot, int segment, const Vector2 &value) {
+		if (slot < c.n_free) {
+			triplets.emplace_back(2*slot,   segment, value(0));
+			triplets.emplace_back(2*slot+1, segment, value(1));
+		}
+	};
+
+	// bending stiffness is inversely proportional to the average length
+	for (size_t i = 0; i < c.bends.size(); i++) {
+		auto [a, b, cc] = c.bends[i];
+		real avg_length = 0.5*(c.length(c.bend_segments[i][0]) + c.length(c.bend_segments[i][1]));
+		real k = k_global*k_bend*c.width(b)/avg_length;
+
+		Vector6 corner;
+		corner <<
+			pos.col(a),
+			pos.col(b),
+			pos.col(cc);
+		Vector6 grad_theta;
+		real theta = angle(corner, &grad_theta);
+		real theta_tilde = M_PI;
+
+		// d/d avg_length of the gradient, each segment is half the average
+		Vector6 d = -0.5 * k/avg_length * 2*(theta-theta_tilde) * grad_theta;
+		for (int segment : c.bend_segments[i]) {
+			add(a,  segment, d.segment<2>(0));
+			add(b,  segment, d.segment<2>(2));
+			add(cc, segment, d.segment<2>(4));
+		}
+	}
+
+	// membrane energy / constraint
+	for (size_t i = 0; i < c.segments.size(); i++) {
+		auto [s, e] = c.segments[i];
+		Vector2 u = (pos.col(e) - pos.col(s)).normalized();
+		add(s, i,  2*k_global*lambda_membrane * u);
+		add(e, i, -2*k_global*lambda_membrane * u);
+	}
+
+	// gravity, through the mass each segment gives its end points
+	for (size_t i = 0; i < c.segments.size(); i++) {
+		auto [s, e] = c.segments[i];
+		real center_width = 0.5*(c.width(s) + c.width(e));
+		real mass_s = 0.5*(c.width(s) + center_width)*0.5 * density;
+		real mass_e = 0.5*(c.width(e) + center_width)*0.5 * density;
+		add(s, i, -k_global * mass_s * gravity);
+		add(e, i, -k_global * mass_e * gravity);
 	}
-	
-	res += air_mesh.penalty(k_global * lambda_air_mesh, x, grad);
 
+	Eigen::SparseMatrix<real> res(2*c.n_free, c.segments.size());
+	res.setFromTriplets(triplets.begin(), triplets.end());
 	return res;
 }
 
@@ -305,7 +658,50 @@ bool SimulationMesh::relax_air_mesh() {
 
 	assert(vertices.size() == air_mesh.vertices.size());
 
-	return air_mesh.relax(x);
+	auto start = std::chrono::steady_clock::now();
+	bool flipped = air_mesh.relax(x);
+	statistics.relax_calls++;
+	statistics.relax_flips += flipped;
+	statistics.relax_time += std::chrono::duration<real>(std::chrono::steady_clock::now() - start).count();
+	return flipped;
+}
+
+real SimulationMesh::max_feasible_step(const VectorX &x, const VectorX &dir) const {
+	if (!use_barrier || air_mesh.empty()) {
+		return infinity;
+	}
+	return air_mesh.max_feasible_step(x, dir);
+}
+
+void SimulationMesh::clamp_to_feasible(const VectorX &x, VectorX &new_x) const {
+	VectorX dir = new_x - x;
+	real t = max_feasible_step(x, dir);
+	if (t <= 1.) {
+		// stop short of the collapse, where the barrier is still finite
+		new_x = x + 0.9 * t * dir;
+	}
+}
+
+bool SimulationMesh::make_feasible() {
+	if (!use_barrier || air_mesh.empty()) {
+		return false;
+	}
+	if (std::isfinite(air_mesh.barrier(1., x, nullptr))) {
+		feasible_x = x;
+		feasible_topology_version = topology_version;
+		return false;
+	}
+
+	// arrived here from outside the simulators, e.g. by editing or
+	// prolongation. Relaxing may have flipped edges since, so the previous
+	// state has to be checked against the current triangulation.
+	if (feasible_topology_version == topology_version && feasible_x.size() == x.size()
+	 && std::isfinite(air_mesh.barrier(1., feasible_x, nullptr))) {
+		clamp_to_feasible(feasible_x, x);
+		return true;
+	}
+	air_mesh.project(x);
+	return true;
 }
 
 SimulationMesh SimulationMesh::generate_horizontal_strip(real length, real h) {
@@ -355,21 +751,65 @@ real SimulationMesh::total_mass() const {
 	return res;
 }
 
+SimulationMesh SimulationMesh::clone() const {
+	SimulationMesh res;
+	res.x = x;
+	res.m = m;
+	res.k_global = k_global;
+	res.k_bend = k_bend;
+	res.density = density;
+	res.lambda_membrane = lambda_membrane;
+	res.lambda_air_mesh = lambda_air_mesh;
+	res.use_barrier = use_barrier;
+	res.incremental_air_mesh = incremental_air_mesh;
+	res.gravity = gravity;
+	res.lb = lb;
+	res.ub = ub;
+
+	// copies of the lists, still referring to our vertices and segments
+	res.vertices = vertices;
+	res.segments = segments;
+	res.connection_bends = connection_bends;
+	res.extra_mass = extra_mass;
+	res.external_forces = external_forces;
+
+	Translate<Vertex> vertex(res.vertices);
+	Translate<Segment> segment(res.segments);
+	for (auto &seg : res.segments) {
+		vertex.remap(seg.start);
+		vertex.remap(seg.end);
+	}
+	for (auto &bend : res.connection_bends) {
+		segment.remap(bend[0]);
+		segment.remap(bend[1]);
+	}
+	for (auto &[v, mass] : res.extra_mass) {
+		vertex.remap(v);
+	}
+	for (auto &[v, force] : res.external_forces) {
+		vertex.remap(v);
+	}
+
+	// refers to vertices by value, its handles are rebuilt on first use
+	res.air_mesh = air_mesh;
+	return res;
+}
+
 void SimulationMesh::interpolate_missing_z() {
 	// structured interpolation on connectivity graph
 
-	std::unordered_map<listref<Vertex>, int, listref_hash<Vertex>> vx_to_ix;
+	vector<int> vx_to_ix(vertices.capacity(), -1);
 	vector<listref<Vertex>> ix_to_vx;
 
 	vector<vector<pair<int,real>>> edges(vertices.size());
 	{int i = 0;
 	for (auto it = vertices.begin(); it != vertices.end(); ++it, i++) {
-		vx_to_ix.emplace(it, i);
+		vx_to_ix[it.index()] = i;
 		ix_to_vx.push_back(it);
 	}}
 	for (auto &seg : segments) {
-		edges[vx_to_ix[seg.start]].emplace_back(vx_to_ix[seg.end], seg.length);
-		edges[vx_to_ix[seg.end]].emplace_back(vx_to_ix[seg.start], seg.length);
+		edges[vx_to_ix[seg.start.index()]].emplace_back(vx_to_ix[seg.end.index()], seg.length);
+		edges[vx_to_ix[seg.end.index()]].emplace_back(vx_to_ix[seg.start.index()], seg.length);
 	}
 
 
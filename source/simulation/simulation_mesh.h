@@ -2,6 +2,7 @@
 
 #include "common/common.h"
 #include <variant>
+#include <unordered_map>
 #include "common/clone_helper.h"
 #include "simulation/air_mesh.h"
 
@@ -37,13 +38,47 @@ public:
 		{}
 	};
 
+	/// Flat copy of the lists above used by the energy kernels. Vertices are
+	/// addressed by slot: slots [0, n_free) are the movable vertices (slot == index
+	/// into x), slots [n_free, n_slots) are the fixed ones.
+	/// The index arrays are rebuilt on topology changes only, the parameters
+	/// (lengths, widths, masses, fixed positions) are refreshed in place.
+	struct Compiled {
+		int n_free = 0;
+		int n_slots = 0;
+
+		vector<array<int, 3>> bends; // (a, b, c), bending at b
+		vector<array<int, 2>> bend_segments; // the two segments meeting at b
+		vector<array<int, 2>> segments; // (start, end)
+
+		Matrix<real, 2, -1> fixed_positions; // slot n_free+i
+		VectorX width; // per slot
+		VectorX mass; // per slot
+		VectorX length; // per segment
+		vector<pair<int, real>> extra_mass;
+		vector<pair<int, Vector2>> external_forces;
+		long parameters_version = -1; // changes on every refresh of the parameters
+
+		vector<const Vertex *> vertex_refs;
+		vector<const Segment *> segment_refs;
+		vector<int> slot; // by index() in vertices
+	};
+
+	SimulationMesh() = default;
+	// a copy would get new vertices and segments but keep the compiled
+	// pointers into ours, use clone()
+	SimulationMesh(const SimulationMesh &) = delete;
+	SimulationMesh &operator=(const SimulationMesh &) = delete;
+	// the slot lists keep their nodes, so the compiled arrays stay valid
+	SimulationMesh(SimulationMesh &&) = default;
+	SimulationMesh &operator=(SimulationMesh &&) = default;
 
 	int dof() const;
 	VectorX x;
 	VectorX m;
 
-	list<Vertex> vertices;
-	list<Segment> segments;
+	slot_list<Vertex> vertices;
+	slot_list<Segment> segments;
 	vector<array<listref<Segment>, 2>> connection_bends;
 
 	vector<pair<listref<Vertex>, real>> extra_mass;
@@ -51,11 +86,33 @@ public:
 
 	AirMesh air_mesh = AirMesh();
 
+	// changes on every invalidate_topology()
+	long topology_version = next_version();
+
+	/// Work done by energy() and relax_air_mesh(), for solve reports
+	struct Statistics {
+		int energy_evaluations = 0; // including those with gradient
+		int gradient_evaluations = 0;
+		int relax_calls = 0;
+		int relax_flips = 0; // relax calls that changed the air mesh
+		real energy_time = 0.; // seconds
+		real relax_time = 0.;
+		// in the line searches of Newton and LBFGS, their energy included
+		real line_search_time = 0.;
+	};
+	mutable Statistics statistics;
+
 	real k_global = 10000.0; // global energy factor
 	real k_bend = 14500.0; // 80g
 	real density = 0.080; // 80 g
 	real lambda_membrane = 5e5; // ???
 	real lambda_air_mesh = 1e4; // ???
+	// log barrier instead of the linear penalty on inverted air mesh triangles
+	bool use_barrier = false;
+	// follow push_vertex, split_segment, insert_segment and cleanup with
+	// incremental air mesh updates instead of clearing it until the next
+	// generate_air_mesh()
+	bool incremental_air_mesh = false;
 	Vector2 gravity = Vector2(0.,-981.);
 
 	Vector2 lb = Vector2(-infinity, 0.);
@@ -64,6 +121,22 @@ public:
 	static SimulationMesh generate_horizontal_strip(real length, real h);
 
 	real energy(const VectorX &x, VectorX *grad) const;
+	/// energy() in single precision, see MixedPrecision. The air mesh term is
+	/// still evaluated in double.
+	float energy(const Eigen::VectorXf &x, Eigen::VectorXf *grad) const;
+	/// Appends the hessian of energy() at x, optionally with every local block
+	/// projected to be positive semi-definite
+	void hessian(const VectorX &x, vector<Eigen::Triplet<real>> &triplets, bool project = true) const;
+	/// Derivative of the gradient of energy() at x with respect to the rest
+	/// length of each segment, with the vertex masses following
+	/// segment_mass(). Rows are the entries of x, columns the segments in
+	/// the order of compiled().segments.
+	Eigen::SparseMatrix<real> length_jacobian(const VectorX &x) const;
+	const Compiled &compiled() const;
+	/// Must be called after changing vertices, segments or connection_bends
+	void invalidate_topology();
+	/// Must be called after changing lengths, widths, masses or extra_mass
+	void invalidate_parameters();
 	Vector2 get_vertex_position(Vertex &v) const;
 
 	listref<Vertex> push_vertex(Vector2 position, bool fixed = false);
@@ -74,6 +147,17 @@ public:
 	void generate_air_mesh();
 	bool relax_air_mesh();
 
+	/// Line searches must not cross a collapsing air mesh triangle when
+	/// use_barrier is set, see AirMesh::max_feasible_step. Infinity otherwise.
+	real max_feasible_step(const VectorX &x, const VectorX &dir) const;
+	/// Shortens the step from x to new_x to stay inversion free
+	void clamp_to_feasible(const VectorX &x, VectorX &new_x) const;
+	/// Makes the barrier finite again after x was changed from outside the
+	/// simulators, by backing up towards the state at the previous call.
+	/// Only without such a state (e.g. after a topology change) it falls back
+	/// to AirMesh::project. Returns true if it had to change x.
+	bool make_feasible();
+
 	bool consistent_lengths() const;
 	void perturb(real epsilon);
 
@@ -84,31 +168,43 @@ public:
 	/// Also remove unneeded degrees of freedom from unused entries of x
 	void cleanup();
 	void update_vertex_mass();
+	/// Mass a segment contributes to its start and end vertex, the vertex
+	/// mass is the sum over the incident segments
+	array<real, 2> segment_mass(const Segment &seg) const;
+	/// Sets the mass of a single vertex, also in m. Parameters must be
+	/// invalidated afterwards.
+	void set_vertex_mass(Vertex &vert, real mass);
 
 	void verify();
 
 	real total_mass() const;
 
-	template<typename Tr>
-	SimulationMesh clone(Tr &tr) { // const
-		SimulationMesh res;
-		res.x = x;
-		res.k_bend = k_bend;
-		res.lambda_membrane = lambda_membrane;
-		res.lambda_air_mesh = lambda_air_mesh;
-		res.gravity = gravity;
-		res.lb = lb;
-		res.ub = ub;
-
-		tr.transform(vertices.begin(), vertices.end(), res.vertices, [&](Vertex x){return x;});
-		tr.transform(segments.begin(), segments.end(), res.segments, [&](Segment seg){
-			return Segment(tr(seg.start), tr(seg.end), seg.length);
-		});
-		std::transform(connection_bends.begin(), connection_bends.end(), std::back_inserter(res.connection_bends), [&](array<listref<Segment>, 2> x) {
-			return array<listref<Segment>, 2>({tr(x[0]), tr(x[1])});
-		});
-		return res;
-	}
+	/// Deep copy, references are translated by slot index. The compiled
+	/// arrays are rebuilt on first use.
+	SimulationMesh clone() const;
+
+private:
+	// push_vertex without updating the air mesh
+	listref<Vertex> append_vertex(Vector2 position, bool fixed = false);
+
+	void compile_topology() const;
+	void compile_parameters() const;
+
+	// energy() for Scalar = float or double
+	template<typename Scalar>
+	Scalar energy_impl(const Matrix<Scalar, -1, 1> &x, Matrix<Scalar, -1, 1> *grad) const;
+	// bending and membrane terms of work items [begin, end), which enumerate
+	// the bends followed by the segments
+	template<typename Scalar>
+	Scalar elastic_energy(const Compiled &c, const Matrix<Scalar, 2, -1> &pos, int begin, int end, Matrix<Scalar, 2, -1> *g) const;
+
+	// x at the last make_feasible() that found it inversion free
+	VectorX feasible_x;
+	long feasible_topology_version = -1;
+
+	mutable Compiled compiled_mesh;
+	mutable bool compiled_topology_valid = false;
+	mutable bool compiled_parameters_valid = false;
 };
 std::ostream &operator<<(std::ostream &, const SimulationMesh::Vertex &);
 std::ostream &operator<<(std::ostream &, const SimulationMesh::Segment &);
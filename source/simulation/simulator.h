@@ -1,16 +1,27 @@
 #pragma once
 
 #include "simulation/simulation_mesh.h"
+#include "simulation/solver_cache.h"
 
 namespace ruffles::simulation {
 
 class Simulator {
 public:
+	virtual ~Simulator() = default;
+
 	virtual void reset(const SimulationMesh &) {
 	}
 	virtual bool step(SimulationMesh &) = 0;
 
 	virtual void menu_callback() {}
+
+	/// Copy including the state of the current solve, for Ruffle::clone.
+	/// Simulators don't refer to a mesh, the copy works on any mesh with
+	/// the same degrees of freedom.
+	virtual std::unique_ptr<Simulator> clone() const = 0;
+
+	// kept across reset() and physics solves, only invalidated by topology changes
+	SolverCache solver_cache;
 };
 
 }
@@ -0,0 +1,51 @@
+#include "simulation/solver_cache.h"
+#include "simulation/simulation_mesh.h"
+
+namespace ruffles::simulation {
+
+SolverCache::SolverCache(const SolverCache &other)
+	: analyze_count(other.analyze_count), factorize_count(other.factorize_count)
+{
+}
+
+SolverCache &SolverCache::operator=(const SolverCache &other) {
+	clear();
+	analyze_count = other.analyze_count;
+	factorize_count = other.factorize_count;
+	return *this;
+}
+
+SolverCache::Key SolverCache::key(const SimulationMesh &mesh, bool with_air_mesh) {
+	Key res;
+	res.topology_version = mesh.topology_version;
+	res.air_mesh_version = with_air_mesh ? mesh.air_mesh.version : -1;
+	res.dof = mesh.dof();
+	return res;
+}
+
+bool SolverCache::factorize(const Eigen::SparseMatrix<real> &mat, const Key &key) {
+	if (key != analyzed_key || mat.nonZeros() != analyzed_nonzeros) {
+		solver.analyzePattern(mat);
+		analyzed_key = key;
+		analyzed_nonzeros = mat.nonZeros();
+		analyze_count++;
+	}
+	solver.factorize(mat);
+	factorize_count++;
+	return solver.info() == Eigen::Success;
+}
+
+VectorX SolverCache::solve(const VectorX &rhs) const {
+	return solver.solve(rhs);
+}
+
+MatrixX SolverCache::solve(const MatrixX &rhs) const {
+	return solver.solve(rhs);
+}
+
+void SolverCache::clear() {
+	analyzed_key = Key();
+	analyzed_nonzeros = -1;
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common/common.h"
+
+namespace ruffles::simulation {
+
+class SimulationMesh;
+
+/// Sparse Cholesky factorization that keeps the symbolic analysis (sparsity
+/// pattern and fill-reducing ordering) for as long as the mesh topology stays
+/// the same, so repeated solves only pay for the numeric factorization
+class SolverCache {
+public:
+	struct Key {
+		long topology_version = -1;
+		long air_mesh_version = -1;
+		int dof = -1;
+
+		bool operator==(const Key &other) const {
+			return topology_version == other.topology_version
+			    && air_mesh_version == other.air_mesh_version
+			    && dof == other.dof;
+		}
+		bool operator!=(const Key &other) const {
+			return !(*this == other);
+		}
+	};
+
+	SolverCache() = default;
+	/// Factorizations can't be copied, copies start empty
+	SolverCache(const SolverCache &other);
+	SolverCache &operator=(const SolverCache &other);
+
+	/// Simulators whose matrix does not involve the air mesh leave it out of the key
+	static Key key(const SimulationMesh &mesh, bool with_air_mesh = true);
+
+	/// The sparsity pattern of mat must only depend on key
+	bool factorize(const Eigen::SparseMatrix<real> &mat, const Key &key);
+	VectorX solve(const VectorX &rhs) const;
+	MatrixX solve(const MatrixX &rhs) const;
+
+	void clear();
+
+	int analyze_count = 0;
+	int factorize_count = 0;
+
+private:
+	Eigen::SimplicialLDLT<Eigen::SparseMatrix<real>> solver;
+	Key analyzed_key;
+	Eigen::Index analyzed_nonzeros = -1;
+};
+
+}
@@ -59,6 +59,10 @@ bool Verlet::step(SimulationMesh &mesh) {
 	}
 }
 
+std::unique_ptr<Simulator> Verlet::clone() const {
+	return std::make_unique<Verlet>(*this);
+}
+
 void Verlet::menu_callback() {
 	if (ImGui::InputReal("dt", &dt, 0.01, 0.1)) {
 		dt = max(0., dt);
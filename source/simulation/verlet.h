@@ -15,6 +15,8 @@ public:
 
 	virtual void menu_callback() override;
 
+	virtual std::unique_ptr<Simulator> clone() const override;
+
 	VectorX vel;
 
 	real energy = std::numeric_limits<real>::infinity();